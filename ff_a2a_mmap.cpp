@@ -0,0 +1,303 @@
+// FastFlow all-to-all partition-sort (read -> partition -> sort -> write, no merge)
+// A pre-pass cuts the file into L segments (offset table, or parallel resync on record
+// boundaries) and samples keys for R-1 splitters
+// L-Workers decode their segment and route IndexRec batches by key range to R-Workers
+// Each R-Worker sorts its key range and copies its records straight into its own region of
+// the output file, whose byte offset is the prefix sum of the sizes of the lower ranges
+
+
+#include "utils.hpp"
+#include <ff/ff.hpp>
+#include <ff/all2all.hpp>
+#include <atomic>
+
+using namespace ff;
+
+constexpr std::size_t BATCH      = 4096;  // IndexRec per message L -> R
+constexpr std::size_t OVERSAMPLE = 64;    // sampled keys per R-Worker
+
+// Shared state
+static const char*                g_in_map   = nullptr;   // whole input, read-only
+static char*                      g_out_map  = nullptr;   // whole output, same size as input
+static RecLayout                  g_lay;                  // input layout, kept by the output
+static std::vector<sort_key_t>    g_splitters;            // R-1 keys, bucket = upper_bound
+static std::vector<std::size_t>   g_seg_first;            // L+1 record indices
+static std::vector<std::uint64_t> g_seg_off;              // L+1 byte offsets
+static std::vector< std::vector<std::uint64_t> > g_bytes; // [l][r] bytes routed from l to r
+static std::vector< std::vector<std::size_t> >   g_count; // [l][r] records routed from l to r
+static std::uint64_t              g_offsets_at = 0;       // v2 output offset table
+static std::atomic<long>          g_write_us{0};          // slowest R-Worker write (µs)
+
+struct Batch {
+    std::vector<IndexRec> recs;
+};
+
+// Pre-pass: cut the input into L segments and sample keys for the splitters.
+// v2 inputs with an offset table are cut by record index and sampled through
+// the table, without touching the records. Otherwise the data is cut into L
+// equal byte ranges, each start resynchronised on a record boundary
+// (verify_sync, unordered), and L threads hop over the headers of their range
+// to count and sample its records. A range walk that does not end exactly on
+// the next start (a wrong resync guess) or a total other than n falls back to
+// one serial walk over the whole file.
+static void sample_splitters(std::vector<sort_key_t>& sample, int R)
+{
+    std::sort(sample.begin(), sample.end(), key_less);
+    g_splitters.clear();
+    for (int r = 1; r < R && !sample.empty(); ++r)
+        g_splitters.push_back(sample[(sample.size() * r) / R]);
+    g_splitters.resize(R - 1, SORT_KEY_MAX);   // too few records: empty upper ranges
+}
+
+static bool plan_by_bytes(std::size_t n, std::uint64_t data_end, std::uint32_t max_len,
+                          std::size_t stride, int L, std::vector<sort_key_t>& sample)
+{
+    const std::uint64_t begin = g_lay.data_off;
+    g_seg_off[0] = begin;
+    g_seg_off[L] = data_end;
+    std::vector< std::vector<sort_key_t> > part(L);
+    std::vector<std::size_t> count(L, 0);
+    std::vector<char>        ok(L, 0);
+
+    std::vector<std::thread> ts;
+    for (int l = 1; l < L; ++l)
+        ts.emplace_back([&, l] {
+            g_seg_off[l] = verify_sync(g_in_map, g_lay, begin + (data_end - begin) * l / L, data_end,
+                                       /*ordered=*/false, max_len);
+        });
+    for (auto& t : ts) t.join();
+    ts.clear();
+
+    for (int l = 0; l < L; ++l)
+        ts.emplace_back([&, l] {
+            std::uint64_t pos = g_seg_off[l];
+            const std::uint64_t end = g_seg_off[l + 1];
+            std::size_t i = 0;
+            for (; pos < end; ++i) {
+                if (pos + REC_HDR > end) return;
+                const uint32_t len = RecSchema::len_at(g_in_map + pos);
+                if (i % stride == 0) part[l].push_back(sort_key_at(g_in_map + pos));
+                pos += rec_span(len, g_lay);
+            }
+            count[l] = i;
+            ok[l]    = pos == end;
+        });
+    for (auto& t : ts) t.join();
+
+    std::size_t first = 0;
+    for (int l = 0; l < L; ++l) {
+        if (!ok[l]) return false;
+        g_seg_first[l] = first;
+        first += count[l];
+    }
+    if (first != n) return false;
+    g_seg_first[L] = n;
+    for (auto& p : part) sample.insert(sample.end(), p.begin(), p.end());
+    return true;
+}
+
+static void plan_segments(std::size_t n, std::size_t file_sz, std::uint32_t max_len, int L, int R)
+{
+    BENCH_START(reading);
+    g_seg_first.assign(L + 1, n);
+    g_seg_off.assign(L + 1, 0);
+
+    const std::size_t want   = OVERSAMPLE * static_cast<std::size_t>(R);
+    const std::size_t stride = std::max<std::size_t>(1, n / std::max<std::size_t>(want, 1));
+    std::vector<sort_key_t> sample;
+    sample.reserve(want + L + 1);
+
+    const std::uint64_t* offsets = (g_lay.v2 && g_lay.offsets_at)
+        ? reinterpret_cast<const std::uint64_t*>(g_in_map + g_lay.offsets_at) : nullptr;
+    const std::uint64_t data_end = offsets ? g_lay.offsets_at : file_sz;
+
+    if (offsets) {
+        for (int l = 0; l <= L; ++l) {
+            g_seg_first[l] = (n * l) / L;
+            g_seg_off[l]   = g_seg_first[l] < n ? offsets[g_seg_first[l]] : data_end;
+        }
+        for (std::size_t i = 0; i < n; i += stride) sample.push_back(sort_key_at(g_in_map + offsets[i]));
+    } else if (L == 1 || !plan_by_bytes(n, data_end, max_len, stride, L, sample)) {
+        if (L > 1) std::printf("[plan] segment resync failed, serial walk\n");
+        sample.clear();
+        g_seg_first.assign(L + 1, n);
+        std::uint64_t pos = g_lay.data_off;
+        int seg = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            while (seg < L && i == (n * seg) / L) {
+                g_seg_first[seg] = i;
+                g_seg_off[seg]   = pos;
+                ++seg;
+            }
+            const sort_key_t key = sort_key_at(g_in_map + pos);
+            const uint32_t  len = RecSchema::len_at(g_in_map + pos);
+            if (i % stride == 0) sample.push_back(key);
+            pos += rec_span(len, g_lay);
+        }
+        for (; seg <= L; ++seg) { g_seg_first[seg] = n; g_seg_off[seg] = pos; }
+    }
+
+    sample_splitters(sample, R);
+    BENCH_STOP(reading);
+}
+
+// L-Worker: decode one segment and scatter it by key range
+struct LWorker : ff_monode_t<Batch> {
+    LWorker(int id, int R) : id(id), R(R) {}
+
+    Batch* svc(Batch*) override {
+        std::vector<Batch*>        out(R, nullptr);
+        std::vector<std::uint64_t>& bytes = g_bytes[id];
+        std::vector<std::size_t>&   count = g_count[id];
+
+        std::uint64_t pos = g_seg_off[id];
+        for (std::size_t i = g_seg_first[id]; i < g_seg_first[id + 1]; ++i) {
+            const IndexRec rec = make_index_rec(g_in_map + pos, pos);
+            const std::uint64_t span = rec_span(rec.len, g_lay);
+            pos += span;
+
+            const int r = key_bucket(g_splitters, rec.key);
+            bytes[r] += span;
+            ++count[r];
+            if (!out[r]) { out[r] = new Batch; out[r]->recs.reserve(BATCH); }
+            out[r]->recs.push_back(rec);
+            if (out[r]->recs.size() == BATCH) { ff_send_out_to(out[r], r); out[r] = nullptr; }
+        }
+        for (int r = 0; r < R; ++r)
+            if (out[r]) ff_send_out_to(out[r], r);
+        return EOS;
+    }
+
+    int id, R;
+};
+
+// R-Worker: collect one key range, then sort and write it once every L-Worker is done
+struct RWorker : ff_minode_t<Batch> {
+    explicit RWorker(int id) : id(id) {}
+
+    Batch* svc(Batch* b) override {
+        run.insert(run.end(), b->recs.begin(), b->recs.end());
+        delete b;
+        return GO_ON;
+    }
+
+    // All input channels reached EOS: g_bytes is final
+    void svc_end() override {
+        sort_records(run.data(), run.size());
+
+        const auto t0 = std::chrono::steady_clock::now();
+        std::uint64_t out_off = g_lay.data_off;
+        std::size_t   out_i   = 0;
+        for (int l = 0; l < static_cast<int>(g_bytes.size()); ++l)
+            for (int r = 0; r < id; ++r) { out_off += g_bytes[l][r]; out_i += g_count[l][r]; }
+        for (const IndexRec& r : run) {
+            put_record(g_out_map + out_off, r, g_in_map);
+            if (g_lay.v2)
+                std::memcpy(g_out_map + g_offsets_at + (out_i++) * sizeof(std::uint64_t),
+                            &out_off, sizeof(std::uint64_t));
+            out_off += rec_span(r.len, g_lay);
+        }
+        const long us = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - t0).count();
+        long prev = g_write_us.load();
+        while (us > prev && !g_write_us.compare_exchange_weak(prev, us)) {}
+    }
+
+    int                   id;
+    std::vector<IndexRec> run;
+};
+
+
+// Main
+int main(int argc, char** argv)
+{
+    Params opt = parse_argv(argc, argv);
+
+    // Phase 1 - streaming generation
+    BENCH_START(generate_unsorted);
+    std::string unsorted_file = generate_unsorted_file_mmap(opt.n_records, opt.payload_max, opt.format);
+    BENCH_STOP(generate_unsorted);
+
+    // Optional: probe the data and pick the thread count (-t caps the search)
+    if (opt.autotune)
+        apply_tune(opt, autotune_params(unsorted_file, opt.n_records, opt.payload_max,
+                                        opt.n_threads > 0 ? opt.n_threads : ff_numCores()));
+
+    // Small inputs: single-threaded path, no runtime setup
+    if (small_input(opt)) {
+        run_small_input(unsorted_file, opt);
+        return 0;
+    }
+
+    const std::string sorted_file = "files/sorted_" + std::to_string(opt.n_records) + "_"
+                                  + std::to_string(opt.payload_max) + ".bin";
+
+    // Phase 2+3+4 - plan, then read/partition/sort/write in one all-to-all
+    BENCH_START(reading_and_sorting);
+
+    const int nthreads = opt.n_threads > 0 ? opt.n_threads : ff_numCores();
+    const int L = std::max(1, nthreads / 4);          // scanning is cheap next to sorting
+    const int R = std::max(1, nthreads - L);
+
+    int fd_in = ::open(unsorted_file.c_str(), O_RDONLY);
+    if (fd_in < 0) { std::perror("open in"); return 1; }
+    struct stat st{};
+    if (fstat(fd_in, &st) < 0) { std::perror("fstat in"); return 1; }
+    const std::size_t file_sz = static_cast<std::size_t>(st.st_size);
+
+    void* in_map = ::mmap(nullptr, file_sz, PROT_READ, MAP_SHARED, fd_in, 0);
+    if (in_map == MAP_FAILED) { std::perror("mmap in"); return 1; }
+    g_in_map = static_cast<const char*>(in_map);
+    g_lay    = record_layout(in_map, file_sz);
+
+    plan_segments(opt.n_records, file_sz, opt.payload_max, L, R);
+    g_bytes.assign(L, std::vector<std::uint64_t>(R, 0));
+    g_count.assign(L, std::vector<std::size_t>(R, 0));
+
+    // Same records, same layout: the output is sized up front
+    // (v2: header + padded records + a fresh offset table)
+    g_offsets_at = g_lay.v2 ? g_seg_off[L] : 0;
+    const std::size_t out_sz = g_seg_off[L] + (g_lay.v2 ? opt.n_records * sizeof(std::uint64_t) : 0);
+    int fd_out = ::open(sorted_file.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd_out < 0) { std::perror("open out"); return 1; }
+    if (ftruncate(fd_out, out_sz) < 0) { std::perror("ftruncate"); return 1; }
+    void* out_map = ::mmap(nullptr, out_sz, PROT_WRITE, MAP_SHARED, fd_out, 0);
+    if (out_map == MAP_FAILED) { std::perror("mmap out"); return 1; }
+    g_out_map = static_cast<char*>(out_map);
+
+    std::vector<ff_node*> lworkers, rworkers;
+    for (int l = 0; l < L; ++l) lworkers.push_back(new LWorker(l, R));
+    for (int r = 0; r < R; ++r) rworkers.push_back(new RWorker(r));
+
+    ff_a2a a2a;
+    a2a.add_firstset(lworkers);
+    a2a.add_secondset(rworkers);
+
+    if (a2a.run_and_wait_end() < 0) {
+        error("FastFlow execution failed\n");
+        return 1;
+    }
+    for (auto* w : lworkers) delete w;
+    for (auto* w : rworkers) delete w;
+
+    if (g_lay.v2) {
+        const FileHeaderV2 h = make_header_v2(opt.n_records, out_sz, g_offsets_at, /*sorted=*/true);
+        std::memcpy(g_out_map, &h, sizeof h);
+    }
+    munmap(out_map, out_sz);
+    munmap(in_map, file_sz);
+    close(fd_out);
+    close(fd_in);
+
+    BENCH_STOP(reading_and_sorting);
+
+    // Phase 4 ran inside the R-Workers; report the slowest one
+    std::printf("[%-20s] %10.3f ms\n", "writing", g_write_us.load() / 1000.0);
+
+    // Phase 5 - verify
+    BENCH_START(check_if_sorted);
+    check_if_sorted_mmap(sorted_file, opt.n_records, nthreads);
+    BENCH_STOP(check_if_sorted);
+
+    return 0;
+}
@@ -15,6 +15,7 @@ static IndexRec*     g_base          = nullptr;
 static std::string   g_unsorted_file;
 static std::size_t   g_N             = 0;
 static int           g_notify_every  = 0;     // we use opt.cutoff
+static std::size_t   g_direct        = 0;     // --direct scan depth (0 = mmap)
 static ProgressGate  g_gate;                  // from utils.hpp
 
 // Task model
@@ -85,7 +86,7 @@ struct Worker : ff_node_t<Task> {
         switch (t->kind) {
             case Task::BuildIndex: {
                 // Progressive index builder; notifies g_gate every g_notify_every elements (and at end)
-                build_index_mmap(g_unsorted_file, g_base, g_N, g_notify_every, &g_gate);
+                build_index_mmap(g_unsorted_file, g_base, g_N, g_notify_every, &g_gate, g_direct);
                 delete t;
                 return GO_ON;  // nothing to return to emitter
             }
@@ -121,9 +122,20 @@ int main(int argc, char** argv)
 
     // Phase 1 - streaming generation
     BENCH_START(generate_unsorted);
-    std::string unsorted_file = generate_unsorted_file_mmap(opt.n_records, opt.payload_max);
+    std::string unsorted_file = generate_unsorted_file_mmap(opt.n_records, opt.payload_max, opt.format);
     BENCH_STOP(generate_unsorted);
 
+    // Optional: probe the data and pick cutoff / threads (-t caps the search)
+    if (opt.autotune)
+        apply_tune(opt, autotune_params(unsorted_file, opt.n_records, opt.payload_max,
+                                        opt.n_threads > 0 ? opt.n_threads : ff_numCores()));
+
+    // Small inputs: single-threaded path, no runtime setup
+    if (small_input(opt)) {
+        run_small_input(unsorted_file, opt);
+        return 0;
+    }
+
     // Phase 2+3 - overlap index build + sort
     BENCH_START(reading_and_sorting);
 
@@ -131,7 +143,7 @@ int main(int argc, char** argv)
 
     if (nthreads <= 1) {
         // sequential fallback: build index normally, then std::sort (as before)
-        IndexRec* idx = build_index_mmap(unsorted_file, opt.n_records); // uses allocating overload
+        IndexRec* idx = build_index_mmap(unsorted_file, opt.n_records, opt.direct); // uses allocating overload
         sort_records(idx, opt.n_records);
         // stash into globals only so the rest of the file (Phase 4/5) remains identical
         g_base = idx;
@@ -145,6 +157,7 @@ int main(int argc, char** argv)
         g_unsorted_file = unsorted_file;
         g_N             = opt.n_records;
         g_notify_every  = opt.cutoff;        // wake frequency
+        g_direct        = opt.direct;
         g_gate.reset();
 
         // Farm: 1 emitter + (nthreads-1) workers
@@ -172,14 +185,14 @@ int main(int argc, char** argv)
     BENCH_START(writing);
     rewrite_sorted_mmap(unsorted_file, "files/sorted_"
                         + std::to_string(opt.n_records) + "_"
-                        + std::to_string(opt.payload_max) + ".bin", g_base, opt.n_records);
+                        + std::to_string(opt.payload_max) + ".bin", g_base, opt.n_records, opt.rewrite, opt.window_mb);
     BENCH_STOP(writing);
 
     // Phase 5 - verify
     BENCH_START(check_if_sorted);
     check_if_sorted_mmap("files/sorted_"
                          + std::to_string(opt.n_records) + "_"
-                         + std::to_string(opt.payload_max) + ".bin", opt.n_records);
+                         + std::to_string(opt.payload_max) + ".bin", opt.n_records, nthreads);
     BENCH_STOP(check_if_sorted);
 
     return 0;
@@ -0,0 +1,162 @@
+// FastFlow streaming pipeline: read -> sort farm -> run writer, then merge -> output
+// The Reader cuts the index into runs of --run records and streams them to a farm
+// of sorters; the Writer appends every sorted run to a run file as soon as it
+// arrives, so the disk is busy while later runs are still read and sorted.
+// At most SLOTS runs are in flight: the Reader waits on a ProgressGate that the
+// Writer advances. The final k-way merge streams the run file into the output
+// with a double-buffered async writer.
+
+
+#include "utils.hpp"
+#include <ff/ff.hpp>
+#include <ff/pipeline.hpp>
+#include <ff/farm.hpp>
+
+using namespace ff;
+
+constexpr std::size_t SLOTS = 4;   // runs in flight (read, sorting or being written)
+
+// Shared state
+static const char*    g_in_map  = nullptr;
+static RecLayout      g_lay;                 // input layout (v1 / v2)
+static ProgressGate   g_written;             // runs appended to the run file so far
+static RunCodecStats* g_codec   = nullptr;   // -z: block-compressed run file
+
+struct Run {
+    std::vector<IndexRec> recs;
+};
+
+// Reader (source)
+struct Reader : ff_node_t<Run> {
+    Reader(std::size_t N, std::size_t run_len) : N(N), run_len(run_len) {}
+
+    Run* svc(Run*) override {
+        std::uint64_t pos = g_lay.data_off;
+        std::size_t   i   = 0;
+        for (std::size_t from = 0; from < N; from += run_len, ++i) {
+            if (i >= SLOTS) g_written.wait_until(i + 1 - SLOTS);   // bounded buffer
+            auto* run = new Run;
+            run->recs.resize(std::min(run_len, N - from));
+            read_index_chunk(g_in_map, pos, run->recs.data(), run->recs.size(), g_lay);
+            ff_send_out(run);
+        }
+        return EOS;
+    }
+
+    std::size_t N, run_len;
+};
+
+// Sorter (farm worker)
+struct Sorter : ff_node_t<Run> {
+    Run* svc(Run* run) override {
+        sort_records(run->recs.data(), run->recs.size());
+        return run;
+    }
+};
+
+// Writer (sink): append each sorted run in arrival order
+struct Writer : ff_node_t<Run> {
+    explicit Writer(int fd) : fd(fd) {}
+
+    Run* svc(Run* run) override {
+        segs.push_back(append_run(fd, bytes, g_in_map, run->recs.data(), run->recs.size(), buf, g_codec));
+        bytes += segs.back().bytes;
+        delete run;
+        g_written.notify(segs.size());
+        return GO_ON;
+    }
+
+    int                 fd;
+    std::uint64_t       bytes = 0;
+    std::vector<RunSeg> segs;
+    std::vector<char>   buf;
+};
+
+
+// Main
+int main(int argc, char** argv)
+{
+    Params opt = parse_argv(argc, argv);
+
+    // Phase 1 - streaming generation
+    BENCH_START(generate_unsorted);
+    std::string unsorted_file = generate_unsorted_file_mmap(opt.n_records, opt.payload_max, opt.format);
+    BENCH_STOP(generate_unsorted);
+
+    // Optional: probe the data and pick run length / threads (-t caps the search)
+    if (opt.autotune)
+        apply_tune(opt, autotune_params(unsorted_file, opt.n_records, opt.payload_max,
+                                        opt.n_threads > 0 ? opt.n_threads : ff_numCores()));
+
+    // Small inputs: single-threaded path, no runtime setup
+    if (small_input(opt)) {
+        run_small_input(unsorted_file, opt);
+        return 0;
+    }
+
+    const std::string tag         = std::to_string(opt.n_records) + "_" + std::to_string(opt.payload_max);
+    const std::string run_file    = "files/runs_" + tag + ".bin";
+    const std::string sorted_file = "files/sorted_" + tag + ".bin";
+
+    // Phase 2+3 - pipelined read, sort and run write
+    BENCH_START(reading_and_sorting);
+
+    int fd_in = ::open(unsorted_file.c_str(), O_RDONLY);
+    if (fd_in < 0) { std::perror("open"); return 1; }
+    struct stat st{};
+    if (fstat(fd_in, &st) < 0) { std::perror("fstat"); return 1; }
+    const std::size_t file_sz = static_cast<std::size_t>(st.st_size);
+    void* map = ::mmap(nullptr, file_sz, PROT_READ, MAP_SHARED, fd_in, 0);
+    if (map == MAP_FAILED) { std::perror("mmap"); return 1; }
+    g_in_map = static_cast<const char*>(map);
+    g_lay    = record_layout(map, file_sz);
+
+    int fd_run = ::open(run_file.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd_run < 0) { std::perror("open runs"); return 1; }
+
+    // Reader + Writer take two threads, the rest sort
+    const int nthreads = opt.n_threads > 0 ? opt.n_threads : ff_numCores();
+    g_written.reset();
+    RunCodecStats codec;
+    if (opt.compress) g_codec = &codec;
+
+    Reader reader(opt.n_records, pipeline_run_len(opt, SLOTS, std::max(1, nthreads - 2)));
+    Writer writer(fd_run);
+    std::vector<ff_node*> sorters;
+    for (int i = 0; i < std::max(1, nthreads - 2); ++i) sorters.push_back(new Sorter());
+
+    ff_farm farm;
+    farm.add_workers(sorters);
+    farm.add_collector(nullptr);
+
+    ff_pipeline pipe;
+    pipe.add_stage(&reader);
+    pipe.add_stage(&farm);
+    pipe.add_stage(&writer);
+
+    if (pipe.run_and_wait_end() < 0) {
+        error("FastFlow execution failed\n");
+        return 1;
+    }
+    for (auto* w : sorters) delete w;
+
+    munmap(map, file_sz);
+    close(fd_in);
+    close(fd_run);
+
+    BENCH_STOP(reading_and_sorting);
+
+    // Phase 4 - merge runs straight into the output file
+    BENCH_START(writing);
+    if (!merge_run_file(run_file, writer.segs, sorted_file, g_lay, g_codec)) return 1;
+    ::unlink(run_file.c_str());
+    BENCH_STOP(writing);
+    codec.print();
+
+    // Phase 5 - verify
+    BENCH_START(check_if_sorted);
+    check_if_sorted_mmap(sorted_file, opt.n_records, nthreads);
+    BENCH_STOP(check_if_sorted);
+
+    return 0;
+}
@@ -100,12 +100,23 @@ int main(int argc, char** argv)
 
     // Phase 1 – streaming generation --------------------------------------
     BENCH_START(generate_unsorted);
-    std::string unsorted_file = generate_unsorted_file_mmap(opt.n_records, opt.payload_max);
+    std::string unsorted_file = generate_unsorted_file_mmap(opt.n_records, opt.payload_max, opt.format);
     BENCH_STOP(generate_unsorted);
 
+    // Optional: probe the data and pick cutoff / threads (-t caps the search)
+    if (opt.autotune)
+        apply_tune(opt, autotune_params(unsorted_file, opt.n_records, opt.payload_max,
+                                        opt.n_threads > 0 ? opt.n_threads : ff_numCores()));
+
+    // Small inputs: single-threaded path, no runtime setup
+    if (small_input(opt)) {
+        run_small_input(unsorted_file, opt);
+        return 0;
+    }
+
     // Phase 2 – build index ------------------------------------------------
     BENCH_START(reading_and_sorting);
-    IndexRec*   idx   = build_index_mmap(unsorted_file, opt.n_records);
+    IndexRec*   idx   = build_index_mmap(unsorted_file, opt.n_records, opt.direct);
 
     // Phase 3 – sort index in RAM -----------------------------------------    
     const int nthreads       = opt.n_threads > 0 ? opt.n_threads : ff_numCores();
@@ -141,14 +152,14 @@ int main(int argc, char** argv)
     BENCH_START(writing);
     rewrite_sorted_mmap(unsorted_file, "files/sorted_"
                      + std::to_string(opt.n_records) + "_"
-                     + std::to_string(opt.payload_max) + ".bin", idx, opt.n_records);
+                     + std::to_string(opt.payload_max) + ".bin", idx, opt.n_records, opt.rewrite, opt.window_mb);
     BENCH_STOP(writing);
 
     // Phase 5 – verify -----------------------------------------------------
     BENCH_START(check_if_sorted);
     check_if_sorted_mmap("files/sorted_"
                      + std::to_string(opt.n_records) + "_"
-                     + std::to_string(opt.payload_max) + ".bin", opt.n_records);
+                     + std::to_string(opt.payload_max) + ".bin", opt.n_records, nthreads);
     BENCH_STOP(check_if_sorted);
 
     return 0;
@@ -3,29 +3,42 @@
 // One send and one recv per rank using deterministic slice sizes
 // Locally with mpirun -np 4 ./bin/mpi_pairwise_tree -n 10000000 -p 8 -t 8 -c 10000
 // On Slurm with srun --mpi=pmix -N 4 -n 4 --cpus-per-task=8 ./bin/mpi_pairwise_tree -n 10000000 -p 8 -t 8 -c 10000
+// With several ranks per node add -m shm: intra-node rounds merge in an MPI shared window, only leaders talk over the network
+// With -m rma the merging rank pulls its partner's run with MPI_Rget (passive target) instead of Send/Recv
+// With -m kway any P works: one balanced k-way round per prime factor of P, merged in parallel
+// With -m multiway every rank streams its run to rank 0 (credit flow control) for a single P-way merge
+// With --chunk C the root deals the index in C-record chunks round-robin and ranks sort while receiving
+// With --checkpoint DIR sorted runs and merge rounds are persisted and a rerun resumes from the last one
+// With --dag the local mergesort is spawned flat as a depend() task DAG (no taskwait per node)
+// With -s the root splits the index by sampled key ranges, ranks sort their bucket and the root just concatenates
+// With -z the slices and the pairwise rounds travel delta/varint-encoded (see encode_index_block)
 
 
 #include "utils.hpp"
+#include <functional>           // std::function (RoundHook)
 #include <mpi.h>
 #include <omp.h>
 
 // OpenMP task mergesort for IndexRec - reuses theone of the omp version
+// With a gate, leaves wait until their slice has been received (chunked distribution)
 static inline void mergesort_task(IndexRec* base,
                                   std::size_t left,
                                   std::size_t right,
-                                  int cutoff)
+                                  int cutoff,
+                                  ProgressGate* gate = nullptr)
 {
     if (left >= right) return;
     const std::size_t mid = (left + right) / 2;
 
     if (static_cast<int>(right - left) > cutoff) {
-        #pragma omp task shared(base)
-        mergesort_task(base, left, mid, cutoff);
-        #pragma omp task shared(base)
-        mergesort_task(base, mid + 1, right, cutoff);
+        #pragma omp task shared(base, gate)
+        mergesort_task(base, left, mid, cutoff, gate);
+        #pragma omp task shared(base, gate)
+        mergesort_task(base, mid + 1, right, cutoff, gate);
         #pragma omp taskwait
         merge_records(base, left, mid, right);
     } else {
+        if (gate) gate->wait_until(right + 1);
         sort_records(base + left, right - left + 1);
     }
 }
@@ -41,8 +54,13 @@ static inline MPI_Datatype make_mpi_indexrec_type() {
     MPI_Get_address(&probe.offset, &disp[1]);
     MPI_Get_address(&probe.len,    &disp[2]);
     disp[0] -= base_addr; disp[1] -= base_addr; disp[2] -= base_addr;
-    MPI_Datatype types[3] = { MPI_UNSIGNED_LONG, MPI_UINT64_T, MPI_UINT32_T };
-    MPI_Type_create_struct(3, blocklen, disp, types, &dtype);
+    // the key travels as raw bytes, whatever the schema's key width
+    blocklen[0] = static_cast<int>(sizeof(sort_key_t));
+    MPI_Datatype types[3] = { MPI_BYTE, MPI_UINT64_T, MPI_UINT32_T };
+    MPI_Datatype packed;
+    MPI_Type_create_struct(3, blocklen, disp, types, &packed);
+    MPI_Type_create_resized(packed, 0, sizeof(IndexRec), &dtype);
+    MPI_Type_free(&packed);
     MPI_Type_commit(&dtype);
     return dtype;
 }
@@ -55,25 +73,98 @@ static inline int count_for_rank(int rank, uint64_t total_records, int world_siz
 }
 
 // Size of partner's subtree at a given round (sender’s payload size)
+// counts[k] is the number of records member k of the communicator starts with
 static inline int partner_subtree_size(int partner_rank,
                                        int round,
-                                       uint64_t total_records,
-                                       int world_size)
+                                       const std::vector<int>& counts)
 {
     const int group = 1 << round;
     const int base  = (partner_rank / group) * group;
+    const int size  = static_cast<int>(counts.size());
     int sum = 0;
-    for (int k = 0; k < group; ++k) {
-        sum += count_for_rank(base + k, total_records, world_size);
+    for (int k = 0; k < group && base + k < size; ++k) {
+        sum += counts[base + k];
     }
     return sum;
 }
 
+// Count for rank r when records are dealt in chunks of `chunk` records, round-robin:
+// global chunk j = records [j*chunk, (j+1)*chunk) goes to rank j % P
+static inline int count_for_rank_chunked(int rank, uint64_t total_records, int world_size,
+                                         uint64_t chunk)
+{
+    const uint64_t n_chunks = (total_records + chunk - 1) / chunk;
+    if ((uint64_t)rank >= n_chunks) return 0;
+    const uint64_t mine = (n_chunks - 1 - rank) / world_size + 1;        // chunks rank, rank+P, ...
+    const uint64_t last = rank + (mine - 1) * world_size;                // my last chunk
+    const uint64_t last_n = std::min<uint64_t>(chunk, total_records - last * chunk);
+    return static_cast<int>((mine - 1) * chunk + last_n);
+}
+
+// Initial per-rank counts over MPI_COMM_WORLD (index-range split, or chunked when chunk > 0)
+static inline std::vector<int> world_counts(uint64_t total_records, int world_size,
+                                            uint64_t chunk = 0) {
+    std::vector<int> counts(world_size);
+    for (int r = 0; r < world_size; ++r)
+        counts[r] = chunk ? count_for_rank_chunked(r, total_records, world_size, chunk)
+                          : count_for_rank(r, total_records, world_size);
+    return counts;
+}
+
+// Encoded transfers (-z)
+// The sender encodes a run block by block (encode_index_block) and posts one
+// MPI_Isend per block as soon as it is ready; `blocks` must outlive the requests.
+// Returns the number of bytes put on the wire.
+static std::size_t isend_encoded_run(const IndexRec* run, std::size_t n,
+                                     int dest, int tag, MPI_Comm comm,
+                                     std::vector< std::vector<std::uint8_t> >& blocks,
+                                     std::vector<MPI_Request>& reqs)
+{
+    std::size_t wire = 0;
+    for (std::size_t from = 0; from < n; from += CODEC_BLOCK) {
+        blocks.emplace_back();
+        auto& blk = blocks.back();
+        blk.reserve(16 + std::min(CODEC_BLOCK, n - from) * 8);
+        encode_index_block(run + from, std::min(CODEC_BLOCK, n - from), blk);
+        reqs.emplace_back();
+        MPI_Isend(blk.data(), static_cast<int>(blk.size()), MPI_BYTE, dest, tag, comm, &reqs.back());
+        wire += blk.size();
+    }
+    return wire;
+}
+
+// The receiver knows how many records to expect; it probes each block for its
+// encoded size and decodes it while the following blocks are still arriving.
+static void recv_encoded_run(IndexRec* out, std::size_t expected,
+                             int src, int tag, MPI_Comm comm)
+{
+    std::vector<std::uint8_t> buf;
+    std::size_t got = 0;
+    while (got < expected) {
+        MPI_Status st;
+        int nbytes = 0;
+        MPI_Probe(src, tag, comm, &st);
+        MPI_Get_count(&st, MPI_BYTE, &nbytes);
+        buf.resize(nbytes);
+        MPI_Recv(buf.data(), nbytes, MPI_BYTE, src, tag, comm, MPI_STATUS_IGNORE);
+        got += decode_index_block(buf.data(), out + got);
+    }
+}
+
+// Called by every rank (active or not) after each merge round with the number
+// of rounds completed; used to checkpoint (--checkpoint). Trees can also start
+// at `first_round` when resuming from such a checkpoint.
+using RoundHook = std::function<void(int rounds_done)>;
+
 // Pairwise log2(P) merge tree on IndexRec (no handshakes, no barriers)
 static void pairwise_merge_tree(std::vector<IndexRec>& local_sorted_index,
-                                int world_rank, int world_size,
-                                uint64_t total_records,
-                                MPI_Datatype MPI_IndexRec)
+                                int rank, int size,
+                                const std::vector<int>& counts,
+                                MPI_Comm comm,
+                                MPI_Datatype MPI_IndexRec,
+                                bool compress = false,
+                                int first_round = 0,
+                                const RoundHook& on_round = nullptr)
 {
     std::vector<IndexRec> partner_buf;
     std::vector<IndexRec> concat;
@@ -81,29 +172,36 @@ static void pairwise_merge_tree(std::vector<IndexRec>& local_sorted_index,
     // Iterate merge rounds where the stride doubles each time
     // 1 << round computes 2^round as the current stride
     // Partner for this rank is rank XOR stride
-    // Stop when stride reaches world_size
-    // If partner exceeds world_size we skip that pair
+    // Stop when stride reaches size
+    // If partner exceeds size we skip that pair
     // Example P=8 -> r=0 stride=1: 0-1 2-3 4-5 6-7
     // Example P=8 -> r=1 stride=2: 0-2 1-3 4-6 5-7
     // Example P=8 -> r=2 stride=4: 0-4 1-5 2-6 3-7
-    for (int round = 0; (1 << round) < world_size; ++round) {
+    for (int round = first_round; (1 << round) < size; ++round) {
 
         // Pick partner by flipping the bit for this round
         // ^ is bitwise XOR and (1 << round) selects the bit to flip
         // Example rank 5 (101b): r0 stride 1 -> 5^1=4 (100b), r1 stride 2 -> 5^2=7 (111b), r2 stride 4 -> 5^4=1 (001b)
-        // Works like a hypercube edge per round; skip if partner >= world_size
-        const int partner = world_rank ^ (1 << round);
-        if (partner >= world_size) continue;
+        // Works like a hypercube edge per round; skip if partner >= size
+        // A rank with any of the low `round` bits set has already sent (inactive)
+        const int  partner = rank ^ (1 << round);
+        const bool active  = (rank & ((1 << round) - 1)) == 0;
+        if (!active || partner >= size) {
+            if (on_round) on_round(round + 1);
+            continue;
+        }
 
         const bool i_receive =
-            ((world_rank & ((1 << (round + 1)) - 1)) == 0) && (world_rank < partner);
+            ((rank & ((1 << (round + 1)) - 1)) == 0) && (rank < partner);
 
         if (i_receive) {
-            const int expected = partner_subtree_size(partner, round, total_records, world_size);
+            const int expected = partner_subtree_size(partner, round, counts);
             partner_buf.resize(expected);
-            if (expected > 0) {
+            if (expected > 0 && compress) {
+                recv_encoded_run(partner_buf.data(), expected, partner, /*tag*/ 700 + round, comm);
+            } else if (expected > 0) {
                 MPI_Recv(partner_buf.data(), expected, MPI_IndexRec,
-                         partner, /*tag*/ 700 + round, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                         partner, /*tag*/ 700 + round, comm, MPI_STATUS_IGNORE);
             }
             if (expected == 0) {
                 // nothing
@@ -121,14 +219,486 @@ static void pairwise_merge_tree(std::vector<IndexRec>& local_sorted_index,
             std::vector<IndexRec>().swap(partner_buf);
         } else {
             const int my_n = static_cast<int>(local_sorted_index.size());
-            if (my_n > 0) {
+            if (my_n > 0 && compress) {
+                std::vector< std::vector<std::uint8_t> > blocks;
+                std::vector<MPI_Request> reqs;
+                isend_encoded_run(local_sorted_index.data(), my_n, partner, /*tag*/ 700 + round, comm,
+                                  blocks, reqs);
+                MPI_Waitall(static_cast<int>(reqs.size()), reqs.data(), MPI_STATUSES_IGNORE);
+            } else if (my_n > 0) {
                 MPI_Send(local_sorted_index.data(), my_n, MPI_IndexRec,
-                         partner, /*tag*/ 700 + round, MPI_COMM_WORLD);
+                         partner, /*tag*/ 700 + round, comm);
             }
             local_sorted_index.clear();
             local_sorted_index.shrink_to_fit();
-            break; // inactive for remaining rounds
+            // inactive for remaining rounds
+        }
+        if (on_round) on_round(round + 1);
+    }
+}
+
+// Parallel k-way merge: split the runs into key ranges and let each OpenMP
+// thread merge one range with the loser tree into its slot of `out`
+static void parallel_merge_runs(const std::vector<RunView>& runs, IndexRec* out)
+{
+    const int parts = std::max(1, omp_get_max_threads());
+    const auto cuts = split_runs_by_key(runs, parts);
+    const int  k    = static_cast<int>(runs.size());
+
+    std::vector<std::size_t> out_at(parts + 1, 0);
+    for (int p = 0; p < parts; ++p) {
+        out_at[p + 1] = out_at[p];
+        for (int r = 0; r < k; ++r) out_at[p + 1] += cuts[p + 1][r] - cuts[p][r];
+    }
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int p = 0; p < parts; ++p) {
+        std::vector<RunView> sub(k);
+        for (int r = 0; r < k; ++r)
+            sub[r] = RunView{ runs[r].data + cuts[p][r], cuts[p + 1][r] - cuts[p][r] };
+        merge_runs_kway(sub, out + out_at[p]);
+    }
+}
+
+// Mixed-radix merge schedule for arbitrary P
+// P is factored into primes (ascending), one round per factor: P=6 -> {2,3},
+// P=12 -> {2,2,3}, P=7 -> {7}. In a round of radix k with stride s the rank at
+// each k*s boundary receives the runs of the k-1 ranks at +s, +2s, ... and merges
+// all k runs at once. Every member of a group has gathered the same number of
+// initial slices, so each round is balanced by data volume and no rank idles
+// while others merge unequal subtrees.
+static std::vector<int> merge_radices(int size)
+{
+    std::vector<int> radices;
+    for (int f = 2; size > 1; ++f)
+        while (size % f == 0) { radices.push_back(f); size /= f; }
+    return radices;
+}
+
+static void kway_merge_tree(std::vector<IndexRec>& local_sorted_index,
+                            int rank, int size,
+                            const std::vector<int>& counts,
+                            MPI_Comm comm,
+                            MPI_Datatype MPI_IndexRec,
+                            bool compress = false,
+                            int first_round = 0,
+                            const RoundHook& on_round = nullptr)
+{
+    const std::vector<int> radices = merge_radices(size);
+    int stride = 1;
+    for (int round = 0; round < first_round; ++round) stride *= radices[round];
+
+    for (int round = first_round; round < static_cast<int>(radices.size()); ++round) {
+        const int k     = radices[round];
+        const int group = stride * k;
+        const int tag   = 800 + round;
+
+        if (rank % stride != 0) {
+            // Shipped my run in an earlier round
+        } else if (rank % group == 0) {
+            // Group leader: gather the k-1 member runs, then one k-way merge
+            std::vector< std::vector<IndexRec> > bufs(k - 1);
+            std::vector<MPI_Request> reqs;
+            for (int j = 1; j < k; ++j) {
+                const int member = rank + j * stride;
+                int expected = 0;
+                for (int q = member; q < member + stride; ++q) expected += counts[q];
+                bufs[j - 1].resize(expected);
+                if (expected == 0) continue;
+                if (compress) {
+                    recv_encoded_run(bufs[j - 1].data(), expected, member, tag, comm);
+                } else {
+                    reqs.emplace_back();
+                    MPI_Irecv(bufs[j - 1].data(), expected, MPI_IndexRec, member, tag, comm, &reqs.back());
+                }
+            }
+            MPI_Waitall(static_cast<int>(reqs.size()), reqs.data(), MPI_STATUSES_IGNORE);
+
+            std::vector<RunView> runs;
+            std::size_t total = local_sorted_index.size();
+            runs.push_back(RunView{ local_sorted_index.data(), local_sorted_index.size() });
+            for (auto& b : bufs) { runs.push_back(RunView{ b.data(), b.size() }); total += b.size(); }
+
+            std::vector<IndexRec> merged(total);
+            parallel_merge_runs(runs, merged.data());
+            local_sorted_index.swap(merged);
+        } else {
+            // Member: ship my run to the group leader and stop participating
+            const int leader = rank - (rank % group);
+            const int my_n   = static_cast<int>(local_sorted_index.size());
+            if (my_n > 0 && compress) {
+                std::vector< std::vector<std::uint8_t> > blocks;
+                std::vector<MPI_Request> reqs;
+                isend_encoded_run(local_sorted_index.data(), my_n, leader, tag, comm, blocks, reqs);
+                MPI_Waitall(static_cast<int>(reqs.size()), reqs.data(), MPI_STATUSES_IGNORE);
+            } else if (my_n > 0) {
+                MPI_Send(local_sorted_index.data(), my_n, MPI_IndexRec, leader, tag, comm);
+            }
+            std::vector<IndexRec>().swap(local_sorted_index);
+        }
+        if (on_round) on_round(round + 1);
+        stride = group;
+    }
+}
+
+// Multiway merge at the root
+// Instead of log2(P) rounds, every rank streams its sorted run to rank 0 in
+// STREAM_CHUNK-record chunks and rank 0 runs one P-way loser-tree merge over
+// all of them, so each record crosses the network once and is merged once.
+// Flow control is credit based: a source may have STREAM_CREDITS chunks in
+// flight; rank 0 hands back one credit (an empty TAG_CREDIT message) each time
+// it finishes merging a chunk and reposts that chunk's receive slot.
+constexpr std::size_t STREAM_CHUNK   = 1 << 15;  // records per streamed chunk
+constexpr int         STREAM_CREDITS = 2;        // chunks in flight per source
+constexpr int         TAG_STREAM     = 900;
+constexpr int         TAG_CREDIT     = 901;
+
+// Worst-case encoded size of one chunk (see encode_index_block): block header,
+// then per record a key varint (19 bytes for 128-bit sort keys), a len varint
+// and a 10-byte offset varint
+static inline std::size_t encoded_chunk_cap(std::size_t n)
+{
+    return 32 + n * ((sizeof(sort_key_t) * 8 + 6) / 7 + 5 + 10);
+}
+
+struct StreamSource {
+    int                       rank     = 0;
+    std::size_t               total    = 0;   // records this source sends
+    std::size_t               chunks   = 0;
+    std::size_t               posted   = 0;   // chunks with a receive posted
+    std::size_t               consumed = 0;   // chunks fully merged
+    std::vector<IndexRec>     slot[STREAM_CREDITS];
+    std::vector<std::uint8_t> wire[STREAM_CREDITS];   // -z only
+    MPI_Request               req [STREAM_CREDITS] = { MPI_REQUEST_NULL, MPI_REQUEST_NULL };
+    const IndexRec*           cur      = nullptr;     // chunk being merged
+    std::size_t               cur_n    = 0;
+    std::size_t               pos      = 0;
+
+    std::size_t chunk_n(std::size_t c) const { return std::min(STREAM_CHUNK, total - c * STREAM_CHUNK); }
+};
+
+static void stream_post(StreamSource& src, MPI_Comm comm, MPI_Datatype MPI_IndexRec, bool compress)
+{
+    const std::size_t c = src.posted++;
+    const int         b = static_cast<int>(c % STREAM_CREDITS);
+    if (compress)
+        MPI_Irecv(src.wire[b].data(), static_cast<int>(src.wire[b].size()), MPI_BYTE,
+                  src.rank, TAG_STREAM, comm, &src.req[b]);
+    else
+        MPI_Irecv(src.slot[b].data(), static_cast<int>(src.chunk_n(c)), MPI_IndexRec,
+                  src.rank, TAG_STREAM, comm, &src.req[b]);
+}
+
+// Make the next chunk current; returns false once the source is exhausted
+static bool stream_open(StreamSource& src, bool compress)
+{
+    const std::size_t c = src.consumed;
+    if (c == src.chunks) return false;
+    const int b = static_cast<int>(c % STREAM_CREDITS);
+    MPI_Wait(&src.req[b], MPI_STATUS_IGNORE);
+    if (compress) decode_index_block(src.wire[b].data(), src.slot[b].data());
+    src.cur   = src.slot[b].data();
+    src.cur_n = src.chunk_n(c);
+    src.pos   = 0;
+    return true;
+}
+
+// Current chunk fully merged: recycle its slot for chunk c + STREAM_CREDITS and grant the credit
+static void stream_release(StreamSource& src, MPI_Comm comm, MPI_Datatype MPI_IndexRec, bool compress)
+{
+    ++src.consumed;
+    if (src.posted < src.chunks) {
+        stream_post(src, comm, MPI_IndexRec, compress);
+        MPI_Send(nullptr, 0, MPI_BYTE, src.rank, TAG_CREDIT, comm);
+    }
+}
+
+static void multiway_root_merge(std::vector<IndexRec>& local_sorted_index,
+                                int rank, int size,
+                                const std::vector<int>& counts,
+                                MPI_Comm comm,
+                                MPI_Datatype MPI_IndexRec,
+                                bool compress = false)
+{
+    if (size == 1) return;
+
+    if (rank != 0) {
+        // Source: send chunk c once chunk c - STREAM_CREDITS has been merged by the root
+        const std::size_t n      = local_sorted_index.size();
+        const std::size_t chunks = (n + STREAM_CHUNK - 1) / STREAM_CHUNK;
+        std::vector< std::vector<std::uint8_t> > blocks;
+        std::vector<MPI_Request> reqs;
+        for (std::size_t c = 0; c < chunks; ++c) {
+            if (c >= static_cast<std::size_t>(STREAM_CREDITS))
+                MPI_Recv(nullptr, 0, MPI_BYTE, 0, TAG_CREDIT, comm, MPI_STATUS_IGNORE);
+            const IndexRec*   chunk   = local_sorted_index.data() + c * STREAM_CHUNK;
+            const std::size_t chunk_n = std::min(STREAM_CHUNK, n - c * STREAM_CHUNK);
+            if (compress) {
+                isend_encoded_run(chunk, chunk_n, 0, TAG_STREAM, comm, blocks, reqs);
+            } else {
+                reqs.emplace_back();
+                MPI_Isend(chunk, static_cast<int>(chunk_n), MPI_IndexRec, 0, TAG_STREAM, comm, &reqs.back());
+            }
         }
+        MPI_Waitall(static_cast<int>(reqs.size()), reqs.data(), MPI_STATUSES_IGNORE);
+        std::vector<IndexRec>().swap(local_sorted_index);
+        return;
+    }
+
+    // Root: source 0 is my own run, sources 1..P-1 arrive through the credit window
+    std::vector<StreamSource> src(size);
+    std::size_t total = local_sorted_index.size();
+    for (int s = 1; s < size; ++s) {
+        src[s].rank   = s;
+        src[s].total  = counts[s];
+        src[s].chunks = (src[s].total + STREAM_CHUNK - 1) / STREAM_CHUNK;
+        total += src[s].total;
+        for (int b = 0; b < STREAM_CREDITS; ++b) {
+            src[s].slot[b].resize(STREAM_CHUNK);
+            if (compress) src[s].wire[b].resize(encoded_chunk_cap(STREAM_CHUNK));
+        }
+        while (src[s].posted < std::min<std::size_t>(STREAM_CREDITS, src[s].chunks))
+            stream_post(src[s], comm, MPI_IndexRec, compress);
+    }
+
+    const IndexRec* mine   = local_sorted_index.data();
+    const std::size_t mine_n = local_sorted_index.size();
+    std::size_t       mine_pos = 0;
+
+    LoserTree lt;
+    lt.k = size;
+    lt.head.resize(size);
+    lt.done.resize(size);
+    lt.done[0] = (mine_n == 0);
+    if (mine_n) lt.head[0] = mine[0].key;
+    for (int s = 1; s < size; ++s) {
+        lt.done[s] = !stream_open(src[s], compress);
+        if (!lt.done[s]) lt.head[s] = src[s].cur[0].key;
+    }
+    lt.build();
+
+    std::vector<IndexRec> merged(total);
+    std::size_t o = 0;
+    for (int w = lt.winner(); !lt.done[w]; w = lt.winner()) {
+        if (w == 0) {
+            merged[o++] = mine[mine_pos++];
+            if (mine_pos == mine_n) lt.done[0] = 1;
+            else                    lt.head[0] = mine[mine_pos].key;
+        } else {
+            StreamSource& sw = src[w];
+            merged[o++] = sw.cur[sw.pos++];
+            if (sw.pos == sw.cur_n) {
+                stream_release(sw, comm, MPI_IndexRec, compress);
+                if (!stream_open(sw, compress)) lt.done[w] = 1;
+                else                            lt.head[w] = sw.cur[0].key;
+            } else {
+                lt.head[w] = sw.cur[sw.pos].key;
+            }
+        }
+        lt.replay(w);
+    }
+    local_sorted_index.swap(merged);
+}
+
+// One-sided (RMA) merge tree
+// Same pairing as pairwise_merge_tree, but nobody sends: every round each rank
+// exposes its current run in an MPI window and the merging rank pulls the
+// partner's run chunk by chunk with MPI_Rget under a passive-target shared
+// lock. The next chunk is in flight while the current one is being merged,
+// so the transfer is demand-driven and overlaps with the merge itself.
+constexpr std::size_t RMA_CHUNK = 1 << 16;   // records per MPI_Rget (~1.5 MiB)
+
+// Merge my sorted run with the partner's run read through `win`
+static void rma_pull_merge(std::vector<IndexRec>& mine,
+                           int partner, int theirs_n,
+                           MPI_Win win, MPI_Datatype MPI_IndexRec)
+{
+    std::vector<IndexRec> out(mine.size() + theirs_n);
+    std::vector<IndexRec> chunk[2] = { std::vector<IndexRec>(RMA_CHUNK),
+                                       std::vector<IndexRec>(RMA_CHUNK) };
+    MPI_Request req[2] = { MPI_REQUEST_NULL, MPI_REQUEST_NULL };
+
+    MPI_Win_lock(MPI_LOCK_SHARED, partner, 0, win);
+
+    // Post the Rget of the next unrequested chunk into buffer b
+    std::size_t chunk_from[2] = { 0, 0 };
+    std::size_t next_from     = 0;
+    auto fetch = [&](int b) {
+        const int cnt = static_cast<int>(std::min<std::size_t>(RMA_CHUNK, theirs_n - next_from));
+        chunk_from[b] = next_from;
+        MPI_Rget(chunk[b].data(), cnt, MPI_IndexRec, partner,
+                 static_cast<MPI_Aint>(next_from), cnt, MPI_IndexRec, win, &req[b]);
+        next_from += cnt;
+    };
+
+    std::size_t i = 0, o = 0;             // cursor in mine, cursor in out
+    int cur = 0;
+    if (theirs_n > 0) fetch(cur);
+
+    while (req[cur] != MPI_REQUEST_NULL) {
+        MPI_Wait(&req[cur], MPI_STATUS_IGNORE);
+        const std::size_t chunk_n = std::min<std::size_t>(RMA_CHUNK, theirs_n - chunk_from[cur]);
+
+        // Prefetch the next chunk before merging this one
+        const int nxt = cur ^ 1;
+        if (next_from < static_cast<std::size_t>(theirs_n)) fetch(nxt);
+
+        const IndexRec* c = chunk[cur].data();
+        std::size_t j = 0;
+        while (i < mine.size() && j < chunk_n)
+            out[o++] = key_less(c[j].key, mine[i].key) ? c[j++] : mine[i++];
+        while (j < chunk_n) out[o++] = c[j++];   // my run ran out first: keep draining
+
+        cur = nxt;
+    }
+
+    MPI_Win_unlock(partner, win);
+
+    while (i < mine.size()) out[o++] = mine[i++];
+    mine.swap(out);
+}
+
+static void rma_merge_tree(std::vector<IndexRec>& local_sorted_index,
+                           int rank, int size,
+                           const std::vector<int>& counts,
+                           MPI_Comm comm,
+                           MPI_Datatype MPI_IndexRec,
+                           int first_round = 0,
+                           const RoundHook& on_round = nullptr)
+{
+    bool active = (rank & ((1 << first_round) - 1)) == 0;
+    for (int round = first_round; (1 << round) < size; ++round) {
+        // Every rank exposes its run (empty once it has been pulled); creation is collective
+        MPI_Win win;
+        MPI_Win_create(local_sorted_index.empty() ? nullptr : local_sorted_index.data(),
+                       static_cast<MPI_Aint>(local_sorted_index.size()) * sizeof(IndexRec),
+                       sizeof(IndexRec), MPI_INFO_NULL, comm, &win);
+
+        const int  partner   = rank ^ (1 << round);
+        const bool i_receive = active && partner < size &&
+            ((rank & ((1 << (round + 1)) - 1)) == 0) && (rank < partner);
+        const bool i_am_pulled = active && partner < size && !i_receive;
+
+        if (i_receive) {
+            const int theirs_n = partner_subtree_size(partner, round, counts);
+            rma_pull_merge(local_sorted_index, partner, theirs_n, win, MPI_IndexRec);
+        }
+
+        // Collective: the partner's run stays valid until the puller is done
+        MPI_Win_free(&win);
+
+        if (i_am_pulled) {
+            std::vector<IndexRec>().swap(local_sorted_index);
+            active = false;
+        }
+        if (on_round) on_round(round + 1);
+    }
+}
+
+// Hierarchical (node-aware) merge
+// Ranks on the same host share one MPI window (MPI_Win_allocate_shared) where
+// their slices sit back to back in node-rank order. Intra-node rounds merge
+// adjacent runs in place through plain loads/stores (zero copy), then one
+// leader per node (node rank 0) joins the inter-node pairwise tree over the
+// network with the whole node's run.
+struct NodeComms {
+    MPI_Comm node        = MPI_COMM_NULL;   // ranks sharing this host
+    MPI_Comm leaders     = MPI_COMM_NULL;   // node rank 0 of every host (NULL elsewhere)
+    int      node_rank   = 0;
+    int      node_size   = 1;
+    int      leader_rank = -1;
+    int      leader_size = 0;
+};
+
+static NodeComms make_node_comms(int world_rank)
+{
+    NodeComms nc;
+    // key=world_rank keeps the world order inside each node, so world rank 0 is node rank 0
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, world_rank, MPI_INFO_NULL, &nc.node);
+    MPI_Comm_rank(nc.node, &nc.node_rank);
+    MPI_Comm_size(nc.node, &nc.node_size);
+
+    // ... and world rank 0 is leader rank 0, the final owner of the index
+    const int color = (nc.node_rank == 0) ? 0 : MPI_UNDEFINED;
+    MPI_Comm_split(MPI_COMM_WORLD, color, world_rank, &nc.leaders);
+    if (nc.leaders != MPI_COMM_NULL) {
+        MPI_Comm_rank(nc.leaders, &nc.leader_rank);
+        MPI_Comm_size(nc.leaders, &nc.leader_size);
+    }
+    return nc;
+}
+
+static void free_node_comms(NodeComms& nc)
+{
+    if (nc.leaders != MPI_COMM_NULL) MPI_Comm_free(&nc.leaders);
+    if (nc.node    != MPI_COMM_NULL) MPI_Comm_free(&nc.node);
+}
+
+// Node-local slice storage: one contiguous shared window holding every local slice
+struct NodeWindow {
+    MPI_Win          win  = MPI_WIN_NULL;
+    IndexRec*        base = nullptr;     // start of node rank 0's segment (node-wide view)
+    IndexRec*        mine = nullptr;     // start of this rank's segment
+    std::vector<int> counts;             // records per node rank
+    std::vector<int> starts;             // prefix sums of counts (size node_size + 1)
+};
+
+static NodeWindow alloc_node_window(const NodeComms& nc, int my_count)
+{
+    NodeWindow nw;
+    nw.counts.resize(nc.node_size);
+    MPI_Allgather(&my_count, 1, MPI_INT, nw.counts.data(), 1, MPI_INT, nc.node);
+    nw.starts.assign(nc.node_size + 1, 0);
+    for (int r = 0; r < nc.node_size; ++r) nw.starts[r + 1] = nw.starts[r] + nw.counts[r];
+
+    // Default (contiguous) allocation: segment r starts right after segment r-1
+    void* my_ptr = nullptr;
+    MPI_Win_allocate_shared(static_cast<MPI_Aint>(my_count) * sizeof(IndexRec), sizeof(IndexRec),
+                            MPI_INFO_NULL, nc.node, &my_ptr, &nw.win);
+    nw.mine = static_cast<IndexRec*>(my_ptr);
+
+    // MPI_PROC_NULL returns the first non-empty segment, i.e. the node-wide base
+    MPI_Aint seg_sz; int disp_unit; void* base_ptr = nullptr;
+    MPI_Win_shared_query(nw.win, MPI_PROC_NULL, &seg_sz, &disp_unit, &base_ptr);
+    nw.base = base_ptr ? static_cast<IndexRec*>(base_ptr) : nw.mine;
+
+    // Passive epoch for the whole lifetime; loads/stores are ordered with Win_sync + Barrier
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, nw.win);
+    return nw;
+}
+
+static void free_node_window(NodeWindow& nw)
+{
+    MPI_Win_unlock_all(nw.win);
+    MPI_Win_free(&nw.win);
+    nw.base = nw.mine = nullptr;
+}
+
+// Make local stores visible to the other ranks of the node
+static inline void node_sync(const NodeComms& nc, const NodeWindow& nw)
+{
+    MPI_Win_sync(nw.win);
+    MPI_Barrier(nc.node);
+    MPI_Win_sync(nw.win);
+}
+
+// Intra-node pairwise tree, in place inside the shared window
+// Same schedule as pairwise_merge_tree, but the "receiver" merges its run with
+// the adjacent run of its partner directly in shared memory (no messages).
+static void node_merge_tree(const NodeComms& nc, const NodeWindow& nw)
+{
+    node_sync(nc, nw);   // every local slice is sorted and visible
+    for (int round = 0; (1 << round) < nc.node_size; ++round) {
+        const int stride = 1 << round;
+        const int me     = nc.node_rank;
+        if ((me % (2 * stride)) == 0 && me + stride < nc.node_size) {
+            const int left  = nw.starts[me];
+            const int mid   = nw.starts[me + stride];
+            const int right = nw.starts[std::min(me + 2 * stride, nc.node_size)];
+            if (mid > left && right > mid)
+                merge_records(nw.base, left, mid - 1, right - 1);
+        }
+        node_sync(nc, nw);
     }
 }
 
@@ -148,20 +718,13 @@ static void root_build_and_send_full_slices(const std::string& input_path,
                                             uint64_t           total_records,
                                             int                world_size,
                                             MPI_Datatype       MPI_IndexRec,
-                                            std::vector<IndexRec>& out_local_slice)
+                                            std::vector<IndexRec>& out_local_slice,
+                                            bool               compress = false,
+                                            std::size_t        direct   = 0)
 {
     BENCH_START(reading);
-    // 1) Open and mmap input (same pattern as build_index_mmap)
-    int fd = ::open(input_path.c_str(), O_RDONLY);
-    if (fd < 0) { std::perror("[oneshot] open"); MPI_Abort(MPI_COMM_WORLD, 101); }
-    struct stat st{};
-    if (fstat(fd, &st) < 0) { std::perror("[oneshot] fstat"); close(fd); MPI_Abort(MPI_COMM_WORLD, 102); }
-    const size_t file_sz = st.st_size;
-    void* map = mmap(nullptr, file_sz, PROT_READ, MAP_SHARED, fd, 0);
-    if (map == MAP_FAILED) { std::perror("[oneshot] mmap"); close(fd); MPI_Abort(MPI_COMM_WORLD, 103); }
-    const char* data = static_cast<const char*>(map);
 
-    // 2) Precompute per-rank ranges and reserve vectors at exact capacity
+    // 1) Precompute per-rank ranges and reserve vectors at exact capacity
     std::vector<int> slice_size(world_size);
     std::vector<uint64_t> start_idx(world_size), end_idx(world_size);
     for (int r = 0; r < world_size; ++r) {
@@ -177,79 +740,433 @@ static void root_build_and_send_full_slices(const std::string& input_path,
     std::vector< std::vector<IndexRec> > per_rank(world_size);
     for (int r = 0; r < world_size; ++r) per_rank[r].reserve(slice_size[r]);
 
-    // 3) Isend requests for ranks > 0; initialize null
+    // 2) Isend requests for ranks > 0; initialize null
     std::vector<MPI_Request> send_req(world_size, MPI_REQUEST_NULL);
 
-    //BENCH_START(build_index); // timing: parse + immediate sends when a slice completes
+    // Encoded mode (-z): one Isend per block instead of one per slice
+    std::vector< std::vector<std::uint8_t> > enc_blocks;
+    std::vector<MPI_Request>                 enc_req;
+    std::size_t raw_bytes = 0, wire_bytes = 0;
 
-    // 4) Single pass over the file: fill slices in order.
-    size_t pos = 0;
+    // 3) Single pass over the file: fill slices in order.
     uint64_t current_rank = 0;
-    for (uint64_t i = 0; i < total_records; ++i) {
+    auto take = [&](uint64_t i, const IndexRec& rec) {
         // Move to the correct target rank based on i (indexes are contiguous)
         while (!(start_idx[current_rank] <= i && i < end_idx[current_rank])) {
             ++current_rank;
         }
-
-        // Read header
-        if (pos + sizeof(unsigned long) + sizeof(uint32_t) > file_sz) {
-            std::cerr << "[oneshot] unexpected EOF at rec " << i << "\n";
-            MPI_Abort(MPI_COMM_WORLD, 104);
-        }
-        const unsigned long key = *reinterpret_cast<const unsigned long*>(data + pos);
-        const uint32_t      len = *reinterpret_cast<const uint32_t*>     (data + pos + sizeof(unsigned long));
-
-        per_rank[current_rank].push_back(IndexRec{ key, (uint64_t)pos, len });
+        per_rank[current_rank].push_back(rec);
 
         // If we just completed a non-root rank's slice, send it now.
         if (i + 1 == end_idx[current_rank] && current_rank != 0) {
             const int n = slice_size[(int)current_rank];
-            MPI_Isend(per_rank[current_rank].data(), n, MPI_IndexRec,
-                      (int)current_rank, TAG_FULL_SLICE, MPI_COMM_WORLD, &send_req[(int)current_rank]);
+            raw_bytes += static_cast<std::size_t>(n) * sizeof(IndexRec);
+            if (compress) {
+                wire_bytes += isend_encoded_run(per_rank[current_rank].data(), n, (int)current_rank,
+                                                TAG_FULL_SLICE, MPI_COMM_WORLD, enc_blocks, enc_req);
+            } else {
+                MPI_Isend(per_rank[current_rank].data(), n, MPI_IndexRec,
+                          (int)current_rank, TAG_FULL_SLICE, MPI_COMM_WORLD, &send_req[(int)current_rank]);
+                wire_bytes += static_cast<std::size_t>(n) * sizeof(IndexRec);
+            }
         }
+    };
 
-        pos += sizeof(unsigned long) + sizeof(uint32_t) + len;
-    }
+    if (direct > 0) {
+        scan_records_direct(input_path, total_records, direct, take);
+    } else {
+        // Open and mmap input (same pattern as build_index_mmap)
+        int fd = ::open(input_path.c_str(), O_RDONLY);
+        if (fd < 0) { std::perror("[oneshot] open"); MPI_Abort(MPI_COMM_WORLD, 101); }
+        struct stat st{};
+        if (fstat(fd, &st) < 0) { std::perror("[oneshot] fstat"); close(fd); MPI_Abort(MPI_COMM_WORLD, 102); }
+        const size_t file_sz = st.st_size;
+        void* map = mmap(nullptr, file_sz, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) { std::perror("[oneshot] mmap"); close(fd); MPI_Abort(MPI_COMM_WORLD, 103); }
+        const char* data = static_cast<const char*>(map);
 
-    // BENCH_STOP(build_index);
+        const RecLayout lay = record_layout(data, file_sz);
+        size_t pos = lay.data_off;
+        for (uint64_t i = 0; i < total_records; ++i) {
+            // Read header
+            if (pos + REC_HDR > file_sz) {
+                std::cerr << "[oneshot] unexpected EOF at rec " << i << "\n";
+                MPI_Abort(MPI_COMM_WORLD, 104);
+            }
+            const IndexRec rec = make_index_rec(data + pos, pos);
+            pos += rec_span(rec.len, lay);
+            take(i, rec);
+        }
+        munmap(map, file_sz);
+        close(fd);
+    }
 
-    // 5) Root keeps its own slice locally
+    // 4) Root keeps its own slice locally
     out_local_slice.swap(per_rank[0]);
 
-    // 6) Ensure all Isends completed before unmapping
-    // BENCH_START(distribute_index);
+    // 5) Ensure all Isends completed
     for (int r = 1; r < world_size; ++r) {
         if (send_req[r] != MPI_REQUEST_NULL) {
             MPI_Wait(&send_req[r], MPI_STATUS_IGNORE);
             send_req[r] = MPI_REQUEST_NULL;
         }
     }
-    // BENCH_STOP(distribute_index);
-
-    // 7) Clean up mapping
-    munmap(map, file_sz);
-    close(fd);
+    MPI_Waitall(static_cast<int>(enc_req.size()), enc_req.data(), MPI_STATUSES_IGNORE);
 
     BENCH_STOP(reading);
+    if (compress && raw_bytes > 0)
+        std::printf("[oneshot] wire %zu bytes for %zu raw (%.2fx)\n",
+                    wire_bytes, raw_bytes, (double)raw_bytes / (double)wire_bytes);
 }
 
 // Non-root: pre-post one Irecv for the full slice and wait for it
+// `out` must hold count_for_rank(my_rank) records (a vector or a shared-window segment)
 static void nonroot_recv_full_slice(int                my_rank,
                                     uint64_t           total_records,
                                     int                world_size,
                                     MPI_Datatype       MPI_IndexRec,
-                                    std::vector<IndexRec>& out_local_slice)
+                                    IndexRec*          out,
+                                    bool               compress = false)
 {
     // Size is deterministic: floor(N*(r+1)/P) - floor(N*r/P)
     const int expected = count_for_rank(my_rank, total_records, world_size);
-    out_local_slice.resize(expected);
 
     // BENCH_START(distribute_index);
-    MPI_Recv(out_local_slice.data(), expected, MPI_IndexRec,
-         0, TAG_FULL_SLICE, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    if (compress)
+        recv_encoded_run(out, expected, 0, TAG_FULL_SLICE, MPI_COMM_WORLD);
+    else
+        MPI_Recv(out, expected, MPI_IndexRec,
+             0, TAG_FULL_SLICE, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
     // BENCH_STOP(distribute_index);
 }
 
+// Chunked round-robin distribution (--chunk C)
+// The one-shot scheme above makes rank P-1 wait for almost the whole scan. Here
+// the index is dealt in chunks of C records: global chunk j goes to rank j % P,
+// so as the root scans the file it sends to every rank in turn. Each rank
+// receives its chunks back to back into its local slice and notifies a
+// ProgressGate, so its mergesort leaves start as soon as their part has
+// arrived (same overlap as build_index_mmap + gate in omp_mmap.cpp). The root
+// does the same with its own chunks while it is still scanning.
+constexpr int TAG_CHUNK = 660;
+
+static void root_scan_and_send_chunks(const std::string& input_path,
+                                      uint64_t           total_records,
+                                      int                world_size,
+                                      uint64_t           chunk,
+                                      MPI_Datatype       MPI_IndexRec,
+                                      IndexRec*          my_out,
+                                      ProgressGate*      gate,
+                                      bool               compress = false,
+                                      std::size_t        direct   = 0)
+{
+    BENCH_START(reading);
+
+    // Exact capacity: push_back never reallocates, so posted Isends stay valid
+    std::vector< std::vector<IndexRec> > per_rank(world_size);
+    for (int r = 1; r < world_size; ++r)
+        per_rank[r].reserve(count_for_rank_chunked(r, total_records, world_size, chunk));
+
+    std::vector< std::vector<std::uint8_t> > enc_blocks;
+    std::vector<MPI_Request>                 reqs;
+
+    std::size_t mine_n = 0;
+    auto take = [&](uint64_t i, const IndexRec& rec) {
+        const int  owner      = static_cast<int>((i / chunk) % world_size);
+        const bool chunk_done = ((i + 1) % chunk == 0) || (i + 1 == total_records);
+        if (owner == 0) {
+            my_out[mine_n++] = rec;
+            if (chunk_done && gate) gate->notify(mine_n);
+            return;
+        }
+
+        auto& v = per_rank[owner];
+        v.push_back(rec);
+        if (chunk_done) {
+            const std::size_t n    = (i % chunk) + 1;
+            const IndexRec*   from = v.data() + v.size() - n;
+            if (compress) {
+                isend_encoded_run(from, n, owner, TAG_CHUNK, MPI_COMM_WORLD, enc_blocks, reqs);
+            } else {
+                reqs.emplace_back();
+                MPI_Isend(from, static_cast<int>(n), MPI_IndexRec, owner, TAG_CHUNK,
+                          MPI_COMM_WORLD, &reqs.back());
+            }
+        }
+    };
+
+    if (direct > 0) {
+        scan_records_direct(input_path, total_records, direct, take);
+    } else {
+        int fd = ::open(input_path.c_str(), O_RDONLY);
+        if (fd < 0) { std::perror("[chunked] open"); MPI_Abort(MPI_COMM_WORLD, 111); }
+        struct stat st{};
+        if (fstat(fd, &st) < 0) { std::perror("[chunked] fstat"); close(fd); MPI_Abort(MPI_COMM_WORLD, 112); }
+        const size_t file_sz = st.st_size;
+        void* map = mmap(nullptr, file_sz, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) { std::perror("[chunked] mmap"); close(fd); MPI_Abort(MPI_COMM_WORLD, 113); }
+        const char* data = static_cast<const char*>(map);
+
+        const RecLayout lay = record_layout(data, file_sz);
+        size_t pos = lay.data_off;
+        for (uint64_t i = 0; i < total_records; ++i) {
+            if (pos + REC_HDR > file_sz) {
+                std::cerr << "[chunked] unexpected EOF at rec " << i << "\n";
+                MPI_Abort(MPI_COMM_WORLD, 114);
+            }
+            const IndexRec rec = make_index_rec(data + pos, pos);
+            pos += rec_span(rec.len, lay);
+            take(i, rec);
+        }
+        munmap(map, file_sz);
+        close(fd);
+    }
+    if (gate) gate->notify(mine_n);
+
+    MPI_Waitall(static_cast<int>(reqs.size()), reqs.data(), MPI_STATUSES_IGNORE);
+    BENCH_STOP(reading);
+}
+
+static void nonroot_recv_chunks(int                my_rank,
+                                uint64_t           total_records,
+                                int                world_size,
+                                uint64_t           chunk,
+                                MPI_Datatype       MPI_IndexRec,
+                                IndexRec*          out,
+                                ProgressGate*      gate,
+                                bool               compress = false)
+{
+    const std::size_t expected = count_for_rank_chunked(my_rank, total_records, world_size, chunk);
+    for (std::size_t got = 0; got < expected; ) {
+        const std::size_t n = std::min<std::size_t>(chunk, expected - got);
+        if (compress)
+            recv_encoded_run(out + got, n, 0, TAG_CHUNK, MPI_COMM_WORLD);
+        else
+            MPI_Recv(out + got, static_cast<int>(n), MPI_IndexRec, 0, TAG_CHUNK,
+                     MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        got += n;
+        if (gate) gate->notify(got);
+    }
+    if (gate) gate->notify(expected);
+}
+
+// Key-range distribution (-s)
+// Instead of cutting the index by record position, the root scans it, picks
+// P-1 splitters from a random sample and buckets the index by key range
+// (partition_by_key, threaded). Rank r receives bucket r, whose size it learns
+// from an MPI_Scatter, and sorts it locally. The sorted buckets are gathered
+// back on the root in rank order, and their concatenation is the global order,
+// so phase 4 does no merging at all.
+constexpr int TAG_BUCKET = 670;
+
+static void root_sample_and_send_buckets(const std::string&      input_path,
+                                         uint64_t                total_records,
+                                         int                     world_size,
+                                         MPI_Datatype            MPI_IndexRec,
+                                         std::vector<IndexRec>&  out_vec,
+                                         bool                    compress = false,
+                                         std::size_t             direct   = 0)
+{
+    IndexRec* scan = build_index_mmap(input_path, total_records, direct);
+    const auto splitters = pick_splitters(scan, total_records, world_size);
+    std::vector<IndexRec> buckets(total_records);
+    const std::vector<std::size_t> starts =
+        partition_by_key(scan, total_records, splitters, buckets.data());
+    std::free(scan);
+
+    std::vector<int> counts(world_size);
+    for (int r = 0; r < world_size; ++r) counts[r] = static_cast<int>(starts[r + 1] - starts[r]);
+    int mine = 0;
+    MPI_Scatter(counts.data(), 1, MPI_INT, &mine, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    std::vector< std::vector<std::uint8_t> > blocks;
+    std::vector<MPI_Request> reqs;
+    for (int r = 1; r < world_size; ++r) {
+        if (compress) {
+            isend_encoded_run(buckets.data() + starts[r], counts[r], r, TAG_BUCKET,
+                              MPI_COMM_WORLD, blocks, reqs);
+        } else if (counts[r] > 0) {
+            reqs.emplace_back();
+            MPI_Isend(buckets.data() + starts[r], counts[r], MPI_IndexRec, r, TAG_BUCKET,
+                      MPI_COMM_WORLD, &reqs.back());
+        }
+    }
+    out_vec.assign(buckets.begin(), buckets.begin() + mine);
+    MPI_Waitall(static_cast<int>(reqs.size()), reqs.data(), MPI_STATUSES_IGNORE);
+}
+
+static void nonroot_recv_bucket(MPI_Datatype            MPI_IndexRec,
+                                std::vector<IndexRec>&  out_vec,
+                                bool                    compress = false)
+{
+    int mine = 0;
+    MPI_Scatter(nullptr, 1, MPI_INT, &mine, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    out_vec.resize(mine);
+    if (compress)
+        recv_encoded_run(out_vec.data(), mine, 0, TAG_BUCKET, MPI_COMM_WORLD);
+    else if (mine > 0)
+        MPI_Recv(out_vec.data(), mine, MPI_IndexRec, 0, TAG_BUCKET, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+}
+
+// Concatenate the sorted buckets on rank 0 (rank order == key order)
+static void gather_sorted_buckets(std::vector<IndexRec>& local_index,
+                                  int                    world_rank,
+                                  int                    world_size,
+                                  MPI_Datatype           MPI_IndexRec,
+                                  bool                   compress = false)
+{
+    int mine = static_cast<int>(local_index.size());
+    std::vector<int> counts(world_size), displs(world_size + 1, 0);
+    MPI_Gather(&mine, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    for (int r = 0; r < world_size; ++r) displs[r + 1] = displs[r] + counts[r];
+
+    if (!compress) {
+        std::vector<IndexRec> all(world_rank == 0 ? displs[world_size] : 0);
+        MPI_Gatherv(local_index.data(), mine, MPI_IndexRec,
+                    all.data(), counts.data(), displs.data(), MPI_IndexRec, 0, MPI_COMM_WORLD);
+        if (world_rank == 0) local_index.swap(all);
+        return;
+    }
+
+    if (world_rank == 0) {
+        std::vector<IndexRec> all(displs[world_size]);
+        std::copy(local_index.begin(), local_index.end(), all.begin());
+        for (int r = 1; r < world_size; ++r)
+            recv_encoded_run(all.data() + displs[r], counts[r], r, TAG_BUCKET, MPI_COMM_WORLD);
+        local_index.swap(all);
+    } else {
+        std::vector< std::vector<std::uint8_t> > blocks;
+        std::vector<MPI_Request> reqs;
+        isend_encoded_run(local_index.data(), mine, 0, TAG_BUCKET, MPI_COMM_WORLD, blocks, reqs);
+        MPI_Waitall(static_cast<int>(reqs.size()), reqs.data(), MPI_STATUSES_IGNORE);
+    }
+}
+
+// Checkpoint/restart (--checkpoint DIR)
+// Progress is committed in steps: step 1 = local runs sorted, step 1+k = k
+// merge rounds done. At each step every rank writes its current run to
+// DIR/sort_<N>_<P>/rank<r>_step<s>.run (node-local disk, fsync'ed), all ranks
+// meet in a barrier, then rank 0 atomically replaces the manifest with the step
+// and a signature of the run parameters. Runs of step s-2 are dropped after the
+// barrier since step s-1 is already committed. A rerun with the same
+// parameters reads the manifest on rank 0, broadcasts the step, and every rank
+// reloads its run and resumes from there. Round-based trees (pairwise, kway,
+// rma) checkpoint every round, the other modes only the sorted local runs.
+struct Checkpoint {
+    std::string dir;            // empty = disabled
+    std::string sig;            // parameters a restart must match
+    int         rank = 0;
+    double      ms   = 0.0;     // time spent writing and reading checkpoints
+
+    bool enabled() const { return !dir.empty(); }
+    std::string run_path(int step) const {
+        return dir + "/rank" + std::to_string(rank) + "_step" + std::to_string(step) + ".run";
+    }
+    std::string manifest_path() const { return dir + "/manifest"; }
+};
+
+static Checkpoint make_checkpoint(const Params& params, int world_rank, int world_size)
+{
+    Checkpoint ck;
+    ck.rank = world_rank;
+    if (params.checkpoint_dir.empty()) return ck;
+    ck.dir = params.checkpoint_dir + "/sort_" + std::to_string(params.n_records) + "_"
+                                   + std::to_string(params.payload_max);
+    ck.sig = "np=" + std::to_string(world_size) + ",merge=" + params.merge
+           + ",chunk=" + std::to_string(params.dist_chunk)
+           + ",sample=" + std::to_string(params.sample)
+           + ",format=" + std::to_string(params.format)
+           + ",schema=k" + std::to_string(REC_KEY_BITS) + "l" + std::to_string(REC_LEN_BITS)
+           + ",rec=" + std::to_string(sizeof(IndexRec))
+           + ",sortbits=" + std::to_string(SORT_KEY_BITS) + ",key=" + params.key;
+    std::filesystem::create_directories(ck.dir);
+    return ck;
+}
+
+// Steps already committed by a previous run (0 = start from scratch); collective
+static int checkpoint_resume(Checkpoint& ck)
+{
+    int step = 0;
+    if (ck.enabled() && ck.rank == 0) {
+        if (FILE* f = std::fopen(ck.manifest_path().c_str(), "r")) {
+            char sig[512] = {0};
+            int  s = 0;
+            if (std::fscanf(f, "sig %511s\nstep %d", sig, &s) == 2) {
+                if (ck.sig == sig) step = s;
+                else std::printf("[checkpoint] parameters changed (%s), starting over\n", sig);
+            }
+            std::fclose(f);
+            if (step == 0) ::unlink(ck.manifest_path().c_str());   // stale: its runs use other parameters
+        }
+        if (step > 0) std::printf("[checkpoint] resuming after step %d\n", step);
+    }
+    if (ck.enabled()) MPI_Bcast(&step, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    return step;
+}
+
+static void checkpoint_load(Checkpoint& ck, int step, std::vector<IndexRec>& run)
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    int fd = ::open(ck.run_path(step).c_str(), O_RDONLY);
+    if (fd < 0) { std::perror("[checkpoint] open run"); MPI_Abort(MPI_COMM_WORLD, 301); }
+    struct stat st{};
+    if (fstat(fd, &st) < 0) { std::perror("[checkpoint] fstat run"); MPI_Abort(MPI_COMM_WORLD, 302); }
+    run.resize(st.st_size / sizeof(IndexRec));
+    char*       p    = reinterpret_cast<char*>(run.data());
+    std::size_t left = run.size() * sizeof(IndexRec);
+    while (left > 0) {
+        const ssize_t got = ::read(fd, p, left);
+        if (got <= 0) { std::perror("[checkpoint] read run"); MPI_Abort(MPI_COMM_WORLD, 303); }
+        p += got; left -= got;
+    }
+    ::close(fd);
+    ck.ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Persist `n` records as step `step` and commit it; collective
+static void checkpoint_commit(Checkpoint& ck, int step, const IndexRec* run, std::size_t n)
+{
+    if (!ck.enabled()) return;
+    const auto t0 = std::chrono::steady_clock::now();
+
+    int fd = ::open(ck.run_path(step).c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) { std::perror("[checkpoint] open run"); MPI_Abort(MPI_COMM_WORLD, 304); }
+    const char* p    = reinterpret_cast<const char*>(run);
+    std::size_t left = n * sizeof(IndexRec);
+    while (left > 0) {
+        const ssize_t put = ::write(fd, p, left);
+        if (put <= 0) { std::perror("[checkpoint] write run"); MPI_Abort(MPI_COMM_WORLD, 305); }
+        p += put; left -= put;
+    }
+    ::fsync(fd);
+    ::close(fd);
+
+    MPI_Barrier(MPI_COMM_WORLD);   // every rank holds step `step` on disk
+
+    if (ck.rank == 0) {
+        const std::string tmp = ck.manifest_path() + ".tmp";
+        FILE* f = std::fopen(tmp.c_str(), "w");
+        if (!f) { std::perror("[checkpoint] manifest"); MPI_Abort(MPI_COMM_WORLD, 306); }
+        std::fprintf(f, "sig %s\nstep %d\n", ck.sig.c_str(), step);
+        std::fflush(f);
+        ::fsync(fileno(f));
+        std::fclose(f);
+        std::rename(tmp.c_str(), ck.manifest_path().c_str());
+    }
+    if (step >= 3) ::unlink(ck.run_path(step - 2).c_str());
+
+    ck.ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Job finished: drop every run file and the manifest; collective
+static void checkpoint_finish(Checkpoint& ck, int last_step)
+{
+    if (!ck.enabled()) return;
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (int s = std::max(1, last_step - 1); s <= last_step; ++s) ::unlink(ck.run_path(s).c_str());
+    if (ck.rank == 0) ::unlink(ck.manifest_path().c_str());
+}
+
 // Main
 int main(int argc, char** argv)
 {
@@ -257,54 +1174,218 @@ int main(int argc, char** argv)
     Params params = parse_argv(argc, argv);
     if (params.n_threads > 0) omp_set_num_threads(params.n_threads);
 
-    MPI_Init(&argc, &argv);
+    // Chunked distribution calls MPI from inside an OpenMP parallel region (one caller at a time)
+    int provided = MPI_THREAD_SINGLE;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &provided);
     int world_rank = 0, world_size = 1;
     MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
     MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    if (params.dist_chunk > 0 && provided < MPI_THREAD_SERIALIZED) {
+        if (world_rank == 0) std::fprintf(stderr, "[rank 0] MPI_THREAD_SERIALIZED unavailable, --chunk ignored\n");
+        params.dist_chunk = 0;
+    }
+    if (params.sample && (params.dist_chunk > 0 || params.merge != "pairwise")) {
+        if (world_rank == 0) std::fprintf(stderr, "[rank 0] -s replaces the merge tree, --chunk and -m ignored\n");
+        params.dist_chunk = 0;
+        params.merge      = "pairwise";
+    }
 
     MPI_Datatype MPI_IndexRec = make_mpi_indexrec_type();
 
     const uint64_t total_records = params.n_records;
+    const std::vector<int> counts = world_counts(total_records, world_size, params.dist_chunk);
 
     // Phase 1: ensure input exists (rank 0)
     std::string unsorted_file;
     if (world_rank == 0) {
         BENCH_START(generate_unsorted);
-        unsorted_file = generate_unsorted_file_mmap(params.n_records, params.payload_max);
+        unsorted_file = generate_unsorted_file_mmap(params.n_records, params.payload_max, params.format);
         BENCH_STOP(generate_unsorted);
     }
 
-    // Phase 2: one-shot index distribution
+    // Optional: rank 0 probes the data for a per-rank slice of N/P and shares the choice
+    if (params.autotune) {
+        unsigned long long tuned[3] = {0, 0, 0};
+        if (world_rank == 0) {
+            const TuneConfig cfg = autotune_params(unsorted_file, std::max<uint64_t>(1, total_records / world_size),
+                                                   params.payload_max, omp_get_max_threads());
+            tuned[0] = cfg.cutoff; tuned[1] = cfg.threads; tuned[2] = cfg.run_len;
+        }
+        MPI_Bcast(tuned, 3, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+        apply_tune(params, TuneConfig{ tuned[0], tuned[1], tuned[2] });
+        omp_set_num_threads(params.n_threads);
+    }
+
+    // Small inputs: rank 0 sorts alone on the single-threaded path, the others just leave
+    if (total_records <= small_input_records(params)) {
+        if (world_rank == 0) run_small_input(unsorted_file, params);
+        MPI_Type_free(&MPI_IndexRec);
+        MPI_Finalize();
+        return 0;
+    }
+
+    // Checkpoint/restart: steps committed by a previous run with the same parameters
+    Checkpoint ckpt = make_checkpoint(params, world_rank, world_size);
+    const int  resume_step = checkpoint_resume(ckpt);
+    int        last_step   = 1;
+
+    // Phase 2: index distribution (one-shot, or chunked with --chunk)
     std::vector<IndexRec> local_index;
+    int my_count = counts[world_rank];   // bucket size with -s, known after phase 2
 
     BENCH_START(reading_and_sorting);
 
-    if (world_rank == 0) {
-        root_build_and_send_full_slices(
-            unsorted_file, total_records, world_size, MPI_IndexRec, local_index);
-        // local_index now holds rank 0’s full slice (unsorted yet)
-    } else {
-        nonroot_recv_full_slice(
-            world_rank, total_records, world_size, MPI_IndexRec, local_index);
+    // Hierarchical mode: local slices live in a node-wide shared window
+    const bool hier = (params.merge == "shm");
+    NodeComms  nc;
+    NodeWindow nw;
+    if (hier) {
+        nc = make_node_comms(world_rank);
+        nw = alloc_node_window(nc, my_count);
     }
 
-    // Phase 3: local sort (OpenMP mergesort)
-    // BENCH_START(local_sort);
-    #pragma omp parallel
-    {
-        #pragma omp single nowait
-        mergesort_task(local_index.data(),
-                       /*left=*/0,
-                       /*right=*/local_index.empty() ? 0 : local_index.size() - 1,
-                       /*cutoff=*/params.cutoff);
+    if (resume_step > 0) {
+        // Phase 2+3 already done: reload the run of the last committed step
+        checkpoint_load(ckpt, resume_step, local_index);
+        my_count = static_cast<int>(local_index.size());
+        if (hier) {
+            std::memcpy(nw.mine, local_index.data(), local_index.size() * sizeof(IndexRec));
+            std::vector<IndexRec>().swap(local_index);
+        }
+    } else if (params.dist_chunk > 0) {
+        // Phase 2+3 (chunked): receive chunk by chunk while the gated mergesort runs
+        if (!hier) local_index.resize(my_count);
+        IndexRec* local_base = hier ? nw.mine : local_index.data();
+        ProgressGate gate;
+        gate.reset();
+        #pragma omp parallel
+        {
+            #pragma omp single
+            {
+                // A) mergesort on the local slice, leaves gated on arrival
+                #pragma omp task shared(gate)
+                {
+                    if (params.dag)
+                        mergesort_dag(local_base, my_count, params.cutoff, &gate);
+                    else
+                        mergesort_task(local_base, 0, my_count == 0 ? 0 : my_count - 1,
+                                       params.cutoff, &gate);
+                }
+
+                // B) chunk producer (root scans, others receive) runs on this thread, not as a
+                //    task: a queued producer could be starved by leaves blocked on the gate
+                if (world_rank == 0)
+                    root_scan_and_send_chunks(unsorted_file, total_records, world_size,
+                                              params.dist_chunk, MPI_IndexRec, local_base,
+                                              &gate, params.compress, params.direct);
+                else
+                    nonroot_recv_chunks(world_rank, total_records, world_size,
+                                        params.dist_chunk, MPI_IndexRec, local_base,
+                                        &gate, params.compress);
+
+                #pragma omp taskwait
+            }
+        }
+    } else {
+        // Phase 2 (one-shot, or key-range buckets with -s) then Phase 3
+        if (params.sample) {
+            if (world_rank == 0)
+                root_sample_and_send_buckets(unsorted_file, total_records, world_size,
+                                             MPI_IndexRec, local_index, params.compress, params.direct);
+            else
+                nonroot_recv_bucket(MPI_IndexRec, local_index, params.compress);
+            my_count = static_cast<int>(local_index.size());
+        } else if (world_rank == 0) {
+            root_build_and_send_full_slices(
+                unsorted_file, total_records, world_size, MPI_IndexRec, local_index, params.compress,
+                params.direct);
+            // local_index now holds rank 0’s full slice (unsorted yet)
+            if (hier) {
+                std::memcpy(nw.mine, local_index.data(), local_index.size() * sizeof(IndexRec));
+                std::vector<IndexRec>().swap(local_index);
+            }
+        } else if (hier) {
+            nonroot_recv_full_slice(
+                world_rank, total_records, world_size, MPI_IndexRec, nw.mine, params.compress);
+        } else {
+            local_index.resize(my_count);
+            nonroot_recv_full_slice(
+                world_rank, total_records, world_size, MPI_IndexRec, local_index.data(), params.compress);
+        }
+
+        // Phase 3: local sort (OpenMP mergesort)
+        IndexRec* local_base = hier ? nw.mine : local_index.data();
+        // BENCH_START(local_sort);
+        #pragma omp parallel
+        {
+            #pragma omp single nowait
+            {
+                if (params.dag) {
+                    mergesort_dag(local_base, my_count, params.cutoff);
+                } else {
+                    mergesort_task(local_base,
+                                   /*left=*/0,
+                                   /*right=*/my_count == 0 ? 0 : my_count - 1,
+                                   /*cutoff=*/params.cutoff);
+                }
+            }
+        }
+        // BENCH_STOP(local_sort);
     }
-    // BENCH_STOP(local_sort);
+    if (resume_step == 0)
+        checkpoint_commit(ckpt, 1, hier ? nw.mine : local_index.data(), my_count);
 
     // Phase 4: pairwise merge tree (IndexRec only)
     // BENCH_START(distributed_merge);
-    pairwise_merge_tree(local_index, world_rank, world_size, total_records, MPI_IndexRec);
+    const int first_round = std::max(0, resume_step - 1);
+    const RoundHook after_round = [&](int rounds_done) {
+        last_step = 1 + rounds_done;
+        checkpoint_commit(ckpt, last_step, local_index.data(), local_index.size());
+    };
+    const RoundHook on_round = ckpt.enabled() ? after_round : RoundHook{};
+    if (params.sample) {
+        // buckets are disjoint key ranges: concatenating them is the whole merge
+        gather_sorted_buckets(local_index, world_rank, world_size, MPI_IndexRec, params.compress);
+    } else if (hier) {
+        // 4a) zero-copy rounds inside each node
+        node_merge_tree(nc, nw);
+
+        // 4b) node leaders merge node runs across the network
+        if (nc.leaders != MPI_COMM_NULL) {
+            int node_total = nw.starts[nc.node_size];
+            std::vector<int> leader_counts(nc.leader_size);
+            MPI_Allgather(&node_total, 1, MPI_INT, leader_counts.data(), 1, MPI_INT, nc.leaders);
+            local_index.assign(nw.base, nw.base + node_total);
+            pairwise_merge_tree(local_index, nc.leader_rank, nc.leader_size,
+                                leader_counts, nc.leaders, MPI_IndexRec, params.compress);
+        }
+        free_node_window(nw);
+        free_node_comms(nc);
+    } else if (params.merge == "multiway") {
+        multiway_root_merge(local_index, world_rank, world_size,
+                            counts, MPI_COMM_WORLD, MPI_IndexRec,
+                            params.compress);
+    } else if (params.merge == "kway") {
+        kway_merge_tree(local_index, world_rank, world_size,
+                        counts, MPI_COMM_WORLD, MPI_IndexRec,
+                        params.compress, first_round, on_round);
+    } else if (params.merge == "rma") {
+        rma_merge_tree(local_index, world_rank, world_size,
+                       counts, MPI_COMM_WORLD, MPI_IndexRec, first_round, on_round);
+    } else {
+        pairwise_merge_tree(local_index, world_rank, world_size,
+                            counts, MPI_COMM_WORLD, MPI_IndexRec,
+                            params.compress, first_round, on_round);
+    }
     // BENCH_STOP(distributed_merge);
 
+    // Checkpoint overhead is reported apart from the phase timers (slowest rank)
+    if (ckpt.enabled()) {
+        double ckpt_ms = 0.0;
+        MPI_Reduce(&ckpt.ms, &ckpt_ms, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (world_rank == 0) std::printf("[%-20s] %10.3f ms\n", "checkpoint", ckpt_ms);
+    }
+
     // Phase 5: final rewrite (rank 0)
     if (world_rank == 0) {
         BENCH_STOP(reading_and_sorting);
@@ -320,19 +1401,20 @@ int main(int argc, char** argv)
         std::memcpy(final_index, local_index.data(),
                     local_index.size() * sizeof(IndexRec));
 
-        if (!rewrite_sorted_mmap(unsorted_file, output_path, final_index, local_index.size())) {
+        if (!rewrite_sorted_mmap(unsorted_file, output_path, final_index, local_index.size(), params.rewrite, params.window_mb)) {
             std::fprintf(stderr, "[rank 0] rewrite_sorted_mmap failed\n");
             MPI_Abort(MPI_COMM_WORLD, 202);
         }
         BENCH_STOP(writing);
 
         BENCH_START(check_if_sorted);
-        if (!check_if_sorted_mmap(output_path, total_records)) {
+        if (!check_if_sorted_mmap(output_path, total_records, omp_get_max_threads())) {
             std::fprintf(stderr, "[rank 0] check_if_sorted_mmap FAILED\n");
             MPI_Abort(MPI_COMM_WORLD, 203);
         }
         BENCH_STOP(check_if_sorted);
     }
+    checkpoint_finish(ckpt, std::max(last_step, resume_step));
 
     MPI_Type_free(&MPI_IndexRec);
     MPI_Finalize();
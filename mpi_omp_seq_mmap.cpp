@@ -1,4 +1,4 @@
-// mpi_pairwise_tree.cpp  —  Log2(P) pairwise tree, minimal comms
+// mpi_pairwise_tree.cpp  —  Log2(P) pairwise tree, minimal comms, node-shared index build
 // Build: mpic++ -O3 -std=c++20 -fopenmp mpi_pairwise_tree.cpp -o bin/mpi_pairwise_tree
 // Run (Slurm): srun -N 4 -n 4 --cpus-per-task=8 ./bin/mpi_pairwise_tree -n 10000000 -p 8 -t 8 -c 10000
 
@@ -54,8 +54,13 @@ static inline MPI_Datatype make_mpi_indexrec_type() {
     MPI_Get_address(&probe.offset, &disp[1]);
     MPI_Get_address(&probe.len,    &disp[2]);
     disp[0] -= base_addr; disp[1] -= base_addr; disp[2] -= base_addr;
-    MPI_Datatype types[3] = { MPI_UNSIGNED_LONG, MPI_UINT64_T, MPI_UINT32_T };
-    MPI_Type_create_struct(3, blocklen, disp, types, &dtype);
+    // the key travels as raw bytes, whatever the schema's key width
+    blocklen[0] = static_cast<int>(sizeof(sort_key_t));
+    MPI_Datatype types[3] = { MPI_BYTE, MPI_UINT64_T, MPI_UINT32_T };
+    MPI_Datatype packed;
+    MPI_Type_create_struct(3, blocklen, disp, types, &packed);
+    MPI_Type_create_resized(packed, 0, sizeof(IndexRec), &dtype);
+    MPI_Type_free(&packed);
     MPI_Type_commit(&dtype);
     return dtype;
 }
@@ -89,7 +94,7 @@ static inline int partner_subtree_size(int partner_rank,
     const int group = 1 << round;
     const int base  = (partner_rank / group) * group;
     int sum = 0;
-    for (int k = 0; k < group; ++k) {
+    for (int k = 0; k < group && base + k < world_size; ++k) {   // last block may be partial
         sum += count_for_rank(base + k, total_records, world_size);
     }
     return sum;
@@ -169,6 +174,117 @@ static void pairwise_merge_tree(std::vector<IndexRec>& local_sorted_index,
     }
 }
 
+// ============================================================================
+// Node-shared index build
+// Ranks on the same host share one MPI window (MPI_Win_allocate_shared) with
+// their index slices back to back in node-rank order. One rank per node (node
+// rank 0) maps the input and indexes every local slice straight into the
+// window; the local ranks then sort their segment in place. No index bytes
+// cross the network, and within a node nothing is copied through MPI. The
+// page cache serves the input to every leader of a host. If some leader cannot
+// open the input (no shared file system), the driver falls back to the rank-0
+// build + MPI_Scatterv.
+// ============================================================================
+struct NodeShare {
+    MPI_Comm  node      = MPI_COMM_NULL;   // ranks sharing this host
+    int       node_rank = 0;
+    int       node_size = 1;
+    MPI_Win   win       = MPI_WIN_NULL;
+    IndexRec* base      = nullptr;         // node-wide view (segment of node rank 0)
+    IndexRec* mine      = nullptr;         // this rank's segment
+};
+
+static NodeShare make_node_share(int world_rank)
+{
+    NodeShare ns;
+    // key=world_rank keeps the world order, so node-rank order is record order
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, world_rank, MPI_INFO_NULL, &ns.node);
+    MPI_Comm_rank(ns.node, &ns.node_rank);
+    MPI_Comm_size(ns.node, &ns.node_size);
+    return ns;
+}
+
+static void alloc_node_share(NodeShare& ns, int my_count)
+{
+    // Default (contiguous) allocation: segment r starts right after segment r-1
+    void* my_ptr = nullptr;
+    MPI_Win_allocate_shared(static_cast<MPI_Aint>(my_count) * sizeof(IndexRec), sizeof(IndexRec),
+                            MPI_INFO_NULL, ns.node, &my_ptr, &ns.win);
+    ns.mine = static_cast<IndexRec*>(my_ptr);
+
+    // MPI_PROC_NULL returns the first non-empty segment, i.e. the node-wide base
+    MPI_Aint seg_sz; int disp_unit; void* base_ptr = nullptr;
+    MPI_Win_shared_query(ns.win, MPI_PROC_NULL, &seg_sz, &disp_unit, &base_ptr);
+    ns.base = base_ptr ? static_cast<IndexRec*>(base_ptr) : ns.mine;
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, ns.win);
+}
+
+static void free_node_share(NodeShare& ns)
+{
+    if (ns.win != MPI_WIN_NULL) {
+        MPI_Win_unlock_all(ns.win);
+        MPI_Win_free(&ns.win);
+    }
+    if (ns.node != MPI_COMM_NULL) MPI_Comm_free(&ns.node);
+}
+
+// Make the leader's stores visible to the other ranks of the node
+static inline void node_sync(const NodeShare& ns)
+{
+    MPI_Win_sync(ns.win);
+    MPI_Barrier(ns.node);
+    MPI_Win_sync(ns.win);
+}
+
+// Leader: index records [first[r], first[r] + count[r]) of every node rank r
+// into dst (back to back). Slices are in record order; v1 inputs are walked
+// once up to the last one, v2 inputs with an offset table jump straight to
+// each slice and index it in parallel.
+static void build_node_index(const std::string& path, uint64_t total_records,
+                             const std::vector<uint64_t>& first, const std::vector<int>& count,
+                             IndexRec* dst)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { std::perror("open"); MPI_Abort(MPI_COMM_WORLD, 21); }
+    struct stat st{};
+    if (fstat(fd, &st) < 0) { std::perror("fstat"); MPI_Abort(MPI_COMM_WORLD, 21); }
+    const std::size_t file_sz = static_cast<std::size_t>(st.st_size);
+    void* map = ::mmap(nullptr, file_sz, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) { std::perror("mmap"); MPI_Abort(MPI_COMM_WORLD, 21); }
+    const char* data = static_cast<const char*>(map);
+
+    const RecLayout lay = record_layout(data, file_sz);
+    if (lay.v2 && lay.n != total_records) {
+        std::fprintf(stderr, "%s holds %lu records, %lu expected\n", path.c_str(),
+                     static_cast<unsigned long>(lay.n), static_cast<unsigned long>(total_records));
+        MPI_Abort(MPI_COMM_WORLD, 22);
+    }
+    const std::uint64_t* offsets = (lay.v2 && lay.offsets_at)
+        ? reinterpret_cast<const std::uint64_t*>(data + lay.offsets_at) : nullptr;
+
+    std::uint64_t pos = lay.data_off;
+    uint64_t      i   = 0;
+    for (std::size_t r = 0; r < count.size(); dst += count[r], ++r) {
+        if (offsets) {
+            #pragma omp parallel for schedule(static)
+            for (int k = 0; k < count[r]; ++k)
+                dst[k] = make_index_rec(data + offsets[first[r] + k], offsets[first[r] + k]);
+            continue;
+        }
+        for (; i < first[r] + count[r]; ++i) {
+            if (pos + REC_HDR > file_sz) {
+                std::fprintf(stderr, "[node index] unexpected EOF at rec %lu\n", static_cast<unsigned long>(i));
+                MPI_Abort(MPI_COMM_WORLD, 23);
+            }
+            if (i < first[r]) { pos += rec_span(RecSchema::len_at(data + pos), lay); continue; }
+            dst[i - first[r]] = make_index_rec(data + pos, pos);
+            pos += rec_span(dst[i - first[r]].len, lay);
+        }
+    }
+    munmap(map, file_sz);
+    ::close(fd);
+}
+
 int main(int argc, char** argv)
 {
     MPI_Init(&argc, &argv);
@@ -185,20 +301,42 @@ int main(int argc, char** argv)
 
     BENCH_START(total_time);
 
+    // Small inputs: rank 0 sorts alone on the single-threaded path, the others just leave
+    if (params.n_records <= small_input_records(params)) {
+        if (world_rank == 0) {
+            BENCH_START(generate_unsorted);
+            const std::string input_path = generate_unsorted_file_mmap(params.n_records, params.payload_max, params.format);
+            BENCH_STOP(generate_unsorted);
+            run_small_input(input_path, params);
+        }
+        MPI_Type_free(&MPI_IndexRec);
+        MPI_Finalize();
+        return 0;
+    }
+
     // ------------------------------------------------------------------------
-    // Phase 1 (rank 0 only): ensure input exists and build the full IndexRec.
-    // Other ranks do not touch the file; they only receive their index slice.
+    // Phase 1: rank 0 ensures the input exists. With node-shared indexing every
+    // node leader then indexes its node's slices; otherwise rank 0 builds the
+    // full IndexRec and the other ranks only receive their slice.
     // ------------------------------------------------------------------------
-    std::string input_path;   // only used by rank 0 later when rewriting
+    std::string input_path = unsorted_file_path(params.n_records, params.payload_max, params.format);
     IndexRec*   full_index_root = nullptr;   // malloc'ed by build_index_mmap on root
 
     if (world_rank == 0) {
         BENCH_START(generate_unsorted);
-        input_path = generate_unsorted_file_mmap(params.n_records, params.payload_max);
+        input_path = generate_unsorted_file_mmap(params.n_records, params.payload_max, params.format);
         BENCH_STOP(generate_unsorted);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);   // the input is complete before any leader maps it
+
+    NodeShare node = make_node_share(world_rank);
+    int can_read = (node.node_rank != 0) || ::access(input_path.c_str(), R_OK) == 0;
+    MPI_Allreduce(MPI_IN_PLACE, &can_read, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    const bool node_shared = can_read != 0;
 
+    if (world_rank == 0 && !node_shared) {
         BENCH_START(build_index);
-        full_index_root = build_index_mmap(input_path, params.n_records);
+        full_index_root = build_index_mmap(input_path, params.n_records, params.direct);
         BENCH_STOP(build_index);
 
         if (!full_index_root) {
@@ -211,54 +349,90 @@ int main(int argc, char** argv)
     const uint64_t total_records = params.n_records;
 
     // ------------------------------------------------------------------------
-    // Phase 2: Scatter the global index by record-count slices (no Bcast).
-    // Every rank can compute its own receive count deterministically.
+    // Phase 2: Every rank gets a record-count slice (no Bcast): indexed into
+    // the node's shared window, or scattered from rank 0 as a fallback.
+    // Every rank can compute its own slice deterministically.
     // ------------------------------------------------------------------------
     const uint64_t my_start_idx = (total_records * (uint64_t)world_rank)     / world_size;
     const uint64_t my_end_idx   = (total_records * (uint64_t)(world_rank+1)) / world_size;
     const int      my_slice_n   = static_cast<int>(my_end_idx - my_start_idx);
 
-    std::vector<IndexRec> local_index(my_slice_n);
-
-    std::vector<int> send_counts, send_displs;
-    if (world_rank == 0) {
-        send_counts.resize(world_size);
-        send_displs.resize(world_size);
-        for (int r = 0; r < world_size; ++r) {
-            const uint64_t s = (total_records * (uint64_t)r)     / world_size;
-            const uint64_t e = (total_records * (uint64_t)(r+1)) / world_size;
-            send_counts[r] = static_cast<int>(e - s);
-            send_displs[r] = static_cast<int>(s);
+    std::vector<IndexRec> local_index;
+
+    if (node_shared) {
+        // Every node rank's first record and count, in node-rank (= record) order
+        std::vector<int> node_world(node.node_size);
+        MPI_Allgather(&world_rank, 1, MPI_INT, node_world.data(), 1, MPI_INT, node.node);
+        std::vector<uint64_t> first(node.node_size);
+        std::vector<int>      count(node.node_size);
+        for (int r = 0; r < node.node_size; ++r) {
+            first[r] = (total_records * (uint64_t)node_world[r]) / world_size;
+            count[r] = count_for_rank(node_world[r], total_records, world_size);
         }
-    }
-
-    BENCH_START(distribute_index);
-    MPI_Scatterv(
-        /*sendbuf (root only)*/ full_index_root,
-        /*sendcounts*/           world_rank==0 ? send_counts.data() : nullptr,
-        /*displs*/               world_rank==0 ? send_displs.data() : nullptr,
-        /*sendtype*/             MPI_IndexRec,
-        /*recvbuf*/              local_index.data(),
-        /*recvcount*/            my_slice_n,
-        /*recvtype*/             MPI_IndexRec,
-        /*root*/                 0, MPI_COMM_WORLD);
-    BENCH_STOP(distribute_index);
 
-    if (world_rank == 0) { std::free(full_index_root); full_index_root = nullptr; }
+        alloc_node_share(node, my_slice_n);
+        if (node.node_rank == 0) {
+            BENCH_START(build_index);
+            if (params.direct > 0 && node.node_size == world_size)   // one node: the whole input
+                build_index_mmap(input_path, node.base, total_records, 0, nullptr, params.direct);
+            else
+                build_node_index(input_path, total_records, first, count, node.base);
+            BENCH_STOP(build_index);
+        }
+        node_sync(node);   // every segment is filled and visible
+
+        // Phase 3: local sort, in place in this rank's segment of the window
+        BENCH_START(local_sort);
+        #pragma omp parallel
+        {
+            #pragma omp single nowait
+            mergesort_task(node.mine, 0, my_slice_n ? my_slice_n - 1 : 0, params.cutoff);
+        }
+        BENCH_STOP(local_sort);
+        local_index.assign(node.mine, node.mine + my_slice_n);
+        free_node_share(node);
+    } else {
+        free_node_share(node);
+        local_index.resize(my_slice_n);
+
+        std::vector<int> send_counts, send_displs;
+        if (world_rank == 0) {
+            send_counts.resize(world_size);
+            send_displs.resize(world_size);
+            for (int r = 0; r < world_size; ++r) {
+                const uint64_t s = (total_records * (uint64_t)r)     / world_size;
+                const uint64_t e = (total_records * (uint64_t)(r+1)) / world_size;
+                send_counts[r] = static_cast<int>(e - s);
+                send_displs[r] = static_cast<int>(s);
+            }
+        }
 
-    // ------------------------------------------------------------------------
-    // Phase 3: Local sort (OpenMP tasks) of my contiguous IndexRec slice.
-    // ------------------------------------------------------------------------
-    BENCH_START(local_sort);
-    #pragma omp parallel
-    {
-        #pragma omp single nowait
-        mergesort_task(local_index.data(),
-                       /*left=*/0,
-                       /*right=*/local_index.empty() ? 0 : local_index.size() - 1,
-                       /*cutoff=*/params.cutoff);
+        BENCH_START(distribute_index);
+        MPI_Scatterv(
+            /*sendbuf (root only)*/ full_index_root,
+            /*sendcounts*/           world_rank==0 ? send_counts.data() : nullptr,
+            /*displs*/               world_rank==0 ? send_displs.data() : nullptr,
+            /*sendtype*/             MPI_IndexRec,
+            /*recvbuf*/              local_index.data(),
+            /*recvcount*/            my_slice_n,
+            /*recvtype*/             MPI_IndexRec,
+            /*root*/                 0, MPI_COMM_WORLD);
+        BENCH_STOP(distribute_index);
+
+        if (world_rank == 0) { std::free(full_index_root); full_index_root = nullptr; }
+
+        // Phase 3: Local sort (OpenMP tasks) of my contiguous IndexRec slice.
+        BENCH_START(local_sort);
+        #pragma omp parallel
+        {
+            #pragma omp single nowait
+            mergesort_task(local_index.data(),
+                           /*left=*/0,
+                           /*right=*/local_index.empty() ? 0 : local_index.size() - 1,
+                           /*cutoff=*/params.cutoff);
+        }
+        BENCH_STOP(local_sort);
     }
-    BENCH_STOP(local_sort);
 
     // ------------------------------------------------------------------------
     // Phase 4: log2(P) pairwise merge tree (IndexRec only, no Sendrecv).
@@ -286,7 +460,7 @@ int main(int argc, char** argv)
         std::memcpy(final_index, local_index.data(),
                     local_index.size() * sizeof(IndexRec));
 
-        if (!rewrite_sorted_mmap(input_path, output_path, final_index, local_index.size())) {
+        if (!rewrite_sorted_mmap(input_path, output_path, final_index, local_index.size(), params.rewrite, params.window_mb)) {
             std::fprintf(stderr, "[rank 0] rewrite_sorted_mmap failed\n");
             MPI_Abort(MPI_COMM_WORLD, 4);
         }
@@ -294,7 +468,7 @@ int main(int argc, char** argv)
 
         // Optional verification
         BENCH_START(check_if_sorted);
-        if (!check_if_sorted_mmap(output_path, total_records)) {
+        if (!check_if_sorted_mmap(output_path, total_records, omp_get_max_threads())) {
             std::fprintf(stderr, "[rank 0] check_if_sorted_mmap FAILED\n");
             MPI_Abort(MPI_COMM_WORLD, 5);
         }
@@ -1,5 +1,8 @@
 // OpenMP Merge-Sort with overlapped index-building (simple locking)
 // Overlaps progressive index build with task-parallel mergesort
+// With --dag the mergesort tree is spawned flat as a depend() DAG instead of taskwait recursion
+// With -s the index is instead split into one key range per thread by sampled
+// splitters and every range is sorted independently (no merge at all)
 
 #include "utils.hpp"
 #include <omp.h>
@@ -42,16 +45,41 @@ int main(int argc, char** argv)
 
   // 1) Generate unsorted file
   BENCH_START(generate_unsorted);
-  std::string unsorted_file = generate_unsorted_file_mmap(opt.n_records, opt.payload_max);
+  std::string unsorted_file = generate_unsorted_file_mmap(opt.n_records, opt.payload_max, opt.format);
   BENCH_STOP(generate_unsorted);
 
+  // Optional: probe the data and pick cutoff / threads (-t caps the search)
+  if (opt.autotune) {
+    apply_tune(opt, autotune_params(unsorted_file, opt.n_records, opt.payload_max,
+                                    opt.n_threads > 0 ? opt.n_threads : omp_get_max_threads()));
+    omp_set_num_threads(opt.n_threads);
+  }
+
+  // Small inputs: single-threaded path, no runtime setup
+  if (small_input(opt)) {
+    run_small_input(unsorted_file, opt);
+    return 0;
+  }
+
   BENCH_START(reading_and_sorting);
 
   // 2+3) Overlap index build and mergesort
   IndexRec* idx = static_cast<IndexRec*>(std::malloc(opt.n_records * sizeof(IndexRec)));
   if (!idx) { std::perror("malloc"); std::exit(1); }
 
-  {
+  if (opt.sample) {
+    // 2) Full index scan, then bucket by key range
+    IndexRec* scan = build_index_mmap(unsorted_file, opt.n_records, opt.direct);
+    const auto splitters = pick_splitters(scan, opt.n_records, omp_get_max_threads());
+    const std::vector<std::size_t> starts = partition_by_key(scan, opt.n_records, splitters, idx);
+    std::free(scan);
+
+    // 3) Sort every bucket on its own; the concatenation is already globally ordered
+    const int buckets = static_cast<int>(starts.size()) - 1;
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int b = 0; b < buckets; ++b)
+      sort_records(idx + starts[b], starts[b + 1] - starts[b]);
+  } else {
     #pragma omp parallel
     {
       #pragma omp single
@@ -60,13 +88,17 @@ int main(int argc, char** argv)
         ProgressGate gate;
         gate.reset();
 
-        // A) Progressive index builder (wake every opt.cutoff records)
+        // A) Mergesort on the index with readiness gating
         #pragma omp task shared(idx, gate)
-        build_index_mmap(unsorted_file, idx, opt.n_records, opt.cutoff, &gate);
+        {
+          if (opt.dag) mergesort_dag(idx, opt.n_records, opt.cutoff, &gate);
+          else         mergesort_task(idx, 0, opt.n_records - 1, opt.cutoff, &gate);
+        }
 
-        // B) Mergesort on the index with readiness gating
-        #pragma omp task shared(idx, gate)
-        mergesort_task(idx, 0, opt.n_records - 1, opt.cutoff, &gate);
+        // B) Progressive index builder (wake every opt.cutoff records) runs on this
+        //    thread, not as a task: with one thread a queued builder would never
+        //    start while the leaves block on the gate
+        build_index_mmap(unsorted_file, idx, opt.n_records, opt.cutoff, &gate, opt.direct);
 
         #pragma omp taskwait
       }
@@ -80,12 +112,12 @@ int main(int argc, char** argv)
   const std::string sorted_file =
       "files/sorted_" + std::to_string(opt.n_records) + "_"
                        + std::to_string(opt.payload_max) + ".bin";
-  rewrite_sorted_mmap(unsorted_file, sorted_file, idx, opt.n_records);
+  rewrite_sorted_mmap(unsorted_file, sorted_file, idx, opt.n_records, opt.rewrite, opt.window_mb);
   BENCH_STOP(writing);
 
   // 5) Verify
   BENCH_START(check_if_sorted);
-  check_if_sorted_mmap(sorted_file, opt.n_records);
+  check_if_sorted_mmap(sorted_file, opt.n_records, omp_get_max_threads());
   BENCH_STOP(check_if_sorted);
 
   return 0;
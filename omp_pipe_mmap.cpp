@@ -0,0 +1,117 @@
+// OpenMP streaming pipeline: read -> sort -> run file, then merge -> output
+// The index is read in runs of --run records; every run is one chain of tasks
+//   read(i) -> sort(i) -> append(i)
+// so sorted runs are already being written while later runs are read and sorted.
+// Runs cycle through W buffer slots: read(i+W) depends on append(i), which bounds
+// memory to W runs without any blocking wait. The final k-way merge streams the
+// run file into the output with a double-buffered async writer.
+
+#include "utils.hpp"
+#include <omp.h>
+
+constexpr int SLOTS = 4;   // runs in flight (read, sorting or being written)
+
+
+// Main
+int main(int argc, char** argv)
+{
+  Params opt = parse_argv(argc, argv);
+  if (opt.n_threads > 0) omp_set_num_threads(opt.n_threads);
+
+  // 1) Generate unsorted file
+  BENCH_START(generate_unsorted);
+  std::string unsorted_file = generate_unsorted_file_mmap(opt.n_records, opt.payload_max, opt.format);
+  BENCH_STOP(generate_unsorted);
+
+  // Optional: probe the data and pick run length / threads (-t caps the search)
+  if (opt.autotune) {
+    apply_tune(opt, autotune_params(unsorted_file, opt.n_records, opt.payload_max,
+                                    opt.n_threads > 0 ? opt.n_threads : omp_get_max_threads()));
+    omp_set_num_threads(opt.n_threads);
+  }
+
+  // Small inputs: single-threaded path, no runtime setup
+  if (small_input(opt)) {
+    run_small_input(unsorted_file, opt);
+    return 0;
+  }
+
+  const std::string tag       = std::to_string(opt.n_records) + "_" + std::to_string(opt.payload_max);
+  const std::string run_file  = "files/runs_" + tag + ".bin";
+  const std::string sorted_file = "files/sorted_" + tag + ".bin";
+
+  BENCH_START(reading_and_sorting);
+
+  int fd_in = ::open(unsorted_file.c_str(), O_RDONLY);
+  if (fd_in < 0) { std::perror("open"); std::exit(1); }
+  struct stat st{};
+  if (fstat(fd_in, &st) < 0) { std::perror("fstat"); std::exit(1); }
+  const std::size_t file_sz = static_cast<std::size_t>(st.st_size);
+  void* map = ::mmap(nullptr, file_sz, PROT_READ, MAP_SHARED, fd_in, 0);
+  if (map == MAP_FAILED) { std::perror("mmap"); std::exit(1); }
+  const char* in_map = static_cast<const char*>(map);
+  const RecLayout lay = record_layout(map, file_sz);
+
+  int fd_run = ::open(run_file.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd_run < 0) { std::perror("open runs"); std::exit(1); }
+
+  // 2+3) Pipeline: one read/sort/append chain per run
+  const std::size_t run_len = pipeline_run_len(opt, SLOTS, omp_get_max_threads());
+  const std::size_t n_runs  = (opt.n_records + run_len - 1) / run_len;
+
+  std::vector<IndexRec> slot[SLOTS];
+  [[maybe_unused]] char slot_dep[SLOTS];       // dependence handles, one per slot
+  [[maybe_unused]] char read_dep, write_dep;   // keep reads and appends in run order
+  std::uint64_t         read_pos  = lay.data_off;
+  std::uint64_t         run_bytes = 0;
+  std::vector<RunSeg>   segs;
+  std::vector<char>     write_buf;
+  RunCodecStats         codec;                 // -z: block-compressed run file
+  RunCodecStats* const  run_codec = opt.compress ? &codec : nullptr;
+
+  #pragma omp parallel
+  {
+    #pragma omp single
+    {
+      for (std::size_t i = 0; i < n_runs; ++i) {
+        const int         s = static_cast<int>(i % SLOTS);
+        const std::size_t n = std::min(run_len, opt.n_records - i * run_len);
+
+        #pragma omp task default(shared) firstprivate(s, n) depend(inout: slot_dep[s], read_dep)
+        {
+          slot[s].resize(n);
+          read_index_chunk(in_map, read_pos, slot[s].data(), n, lay);
+        }
+
+        #pragma omp task default(shared) firstprivate(s) depend(inout: slot_dep[s])
+        sort_records(slot[s].data(), slot[s].size());
+
+        #pragma omp task default(shared) firstprivate(s) depend(inout: slot_dep[s], write_dep)
+        {
+          segs.push_back(append_run(fd_run, run_bytes, in_map, slot[s].data(), slot[s].size(), write_buf, run_codec));
+          run_bytes += segs.back().bytes;
+        }
+      }
+    }
+  }
+
+  munmap(map, file_sz);
+  close(fd_in);
+  close(fd_run);
+
+  BENCH_STOP(reading_and_sorting);
+
+  // 4) Merge runs straight into the output file
+  BENCH_START(writing);
+  if (!merge_run_file(run_file, segs, sorted_file, lay, run_codec)) std::exit(1);
+  ::unlink(run_file.c_str());
+  BENCH_STOP(writing);
+  codec.print();
+
+  // 5) Verify
+  BENCH_START(check_if_sorted);
+  check_if_sorted_mmap(sorted_file, opt.n_records, omp_get_max_threads());
+  BENCH_STOP(check_if_sorted);
+
+  return 0;
+}
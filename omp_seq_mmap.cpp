@@ -5,6 +5,7 @@
  *      ./bin/openmp   -n 1000000  -p 256  -t 8
  *
  *  where -t sets the number of OpenMP threads (0 = auto).
+ *  With --dag the tree is spawned flat as a depend() DAG (no taskwait).
  *  -------------------------------------------------------------------------*/
 
 #include "utils.hpp"
@@ -47,12 +48,23 @@ int main(int argc, char** argv)
 
     // Phase 1 – streaming generation --------------------------------------
     BENCH_START(generate_unsorted);
-    std::string unsorted_file = generate_unsorted_file_mmap(opt.n_records, opt.payload_max);
+    std::string unsorted_file = generate_unsorted_file_mmap(opt.n_records, opt.payload_max, opt.format);
     BENCH_STOP(generate_unsorted);
 
+    // Optional: probe the data and pick cutoff / threads (-t caps the search)
+    if (opt.autotune)
+        apply_tune(opt, autotune_params(unsorted_file, opt.n_records, opt.payload_max,
+                                        opt.n_threads > 0 ? opt.n_threads : omp_get_max_threads()));
+
+    // Small inputs: single-threaded path, no runtime setup
+    if (small_input(opt)) {
+        run_small_input(unsorted_file, opt);
+        return 0;
+    }
+
     // Phase 2 – build index ------------------------------------------------
     BENCH_START(reading_and_sorting);
-    IndexRec*   idx   = build_index_mmap(unsorted_file, opt.n_records);
+    IndexRec*   idx   = build_index_mmap(unsorted_file, opt.n_records, opt.direct);
 
     // Phase 3 – sort index in RAM -----------------------------------------
     if (opt.n_threads > 0)
@@ -60,7 +72,10 @@ int main(int argc, char** argv)
     #pragma omp parallel
     {
         #pragma omp single nowait
-        mergesort_task(idx, 0, opt.n_records - 1, opt.cutoff);
+        {
+            if (opt.dag) mergesort_dag(idx, opt.n_records, opt.cutoff);
+            else         mergesort_task(idx, 0, opt.n_records - 1, opt.cutoff);
+        }
     }
     BENCH_STOP(reading_and_sorting);
 
@@ -68,14 +83,14 @@ int main(int argc, char** argv)
     BENCH_START(writing);
     rewrite_sorted_mmap(unsorted_file, "files/sorted_"
                      + std::to_string(opt.n_records) + "_"
-                     + std::to_string(opt.payload_max) + ".bin", idx, opt.n_records);
+                     + std::to_string(opt.payload_max) + ".bin", idx, opt.n_records, opt.rewrite, opt.window_mb);
     BENCH_STOP(writing);
 
     // Phase 5 – verify -----------------------------------------------------
     BENCH_START(check_if_sorted);
     check_if_sorted_mmap("files/sorted_"
                      + std::to_string(opt.n_records) + "_"
-                     + std::to_string(opt.payload_max) + ".bin", opt.n_records);
+                     + std::to_string(opt.payload_max) + ".bin", opt.n_records, omp_get_max_threads());
     BENCH_STOP(check_if_sorted);
 
     return 0;
@@ -13,6 +13,10 @@
 # Examples:
 #   ./scripts/run_array_any.sh --bin bin/sequential_seq_mmap
 #   ./scripts/run_array_any.sh --bin bin/openmp_seq_mmap --max-parallel 4
+#   ./scripts/run_array_any.sh --bin bin/omp_mmap --args "--rewrite scatter" --tag scatter
+#   ./scripts/run_array_any.sh --bin bin/k64l32s128/sequential_seq_mmap \
+#       --args "--key asc,40:8 --direct 1" --tag keydirect   # (make SORT_KEY_BITS=128)
+#   (--args is forwarded to the binary; --tag makes results go to results/<binary>_<tag>.csv)
 #
 # Logging:
 #   Single log per array: logs/<binary>_%A.out and logs/<binary>_%A.err
@@ -38,6 +42,8 @@ SCRIPT_PATH="$(readlink -f "$0")"
 mode="submit"
 max_parallel="1"           # array throttle: %1 by default
 BIN=""                     # e.g., bin/openmp_seq_mmap
+EXTRA_ARGS=""              # extra flags forwarded to the binary (e.g. "--rewrite scatter")
+TAG=""                     # optional results suffix
 
 # ------------------------- ARG PARSING ---------------------------
 while [[ $# -gt 0 ]]; do
@@ -45,14 +51,16 @@ while [[ $# -gt 0 ]]; do
     --worker) mode="worker"; shift ;;
     --bin)    BIN="${2:-}"; shift 2 ;;
     --max-parallel) max_parallel="${2:?}"; shift 2 ;;
-    *) echo "Usage: $0 --bin bin/<executable> [--max-parallel N]" >&2; exit 1 ;;
+    --args)   EXTRA_ARGS="${2:-}"; shift 2 ;;
+    --tag)    TAG="${2:-}"; shift 2 ;;
+    *) echo "Usage: $0 --bin bin/<executable> [--max-parallel N] [--args \"...\"] [--tag NAME]" >&2; exit 1 ;;
   esac
 done
 
 [[ -n "$BIN" ]] || { echo "ERROR: --bin is required"; exit 2; }
 [[ "$BIN" == */* ]] || BIN="./bin/$BIN"
 BIN_BASENAME="$(basename "$BIN")"
-OUTCSV="results/${BIN_BASENAME}.csv"
+OUTCSV="results/${BIN_BASENAME}${TAG:+_$TAG}.csv"
 
 # Numeric max of THREADS (used for --cpus-per-task)
 max_threads="${THREADS[0]}"
@@ -78,7 +86,7 @@ if [[ "$mode" == "submit" ]]; then
     --output="logs/${BIN_BASENAME}_%A.out" \
     --error="logs/${BIN_BASENAME}_%A.err" \
     --open-mode=append \
-    "$SCRIPT_PATH" --worker --bin "$BIN"
+    "$SCRIPT_PATH" --worker --bin "$BIN" --args "$EXTRA_ARGS" --tag "$TAG"
   exit 0
 fi
 
@@ -119,12 +127,13 @@ if echo "$BIN_BASENAME" | grep -qiE 'omp|openmp'; then
 fi
 
 # --- status line to STDOUT (so it lands in the single .out file) ---
-echo "[task $SLURM_ARRAY_TASK_ID] bin=$BIN_BASENAME  trial=$trial  N=$n  P=$p  C=$c  T=$T"
+echo "[task $SLURM_ARRAY_TASK_ID] bin=$BIN_BASENAME  trial=$trial  N=$n  P=$p  C=$c  T=$T  ARGS=$EXTRA_ARGS"
 
 # --- run the program; capture output AND also print it to .out ---
 tmplog="$(mktemp)"
 # capture both stdout+stderr to a temp file
-if srun --exclusive -n1 --cpu-bind=cores "$BIN" -n "$n" -p "$p" -c "$c" -t "$T" >"$tmplog" 2>&1; then
+# shellcheck disable=SC2086  # EXTRA_ARGS is intentionally word-split
+if srun --exclusive -n1 --cpu-bind=cores "$BIN" -n "$n" -p "$p" -c "$c" -t "$T" $EXTRA_ARGS >"$tmplog" 2>&1; then
   : # ok
 else
   echo "[task $SLURM_ARRAY_TASK_ID] WARNING: program exited non-zero" >&2
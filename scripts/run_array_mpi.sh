@@ -4,13 +4,15 @@
 #
 # WHAT IT DOES
 #   Submits ONE Slurm job array per requested NODES value for your chosen MPI binary.
-#   Each array sweeps: TRIALS × RECORDS × PAYLOAD_MAX × CUTOFFS × THREADS.
-#   Each task runs exactly 1 MPI rank per node, with T threads per rank.
+#   Each array sweeps: TRIALS × RECORDS × PAYLOAD_MAX × CUTOFFS × THREADS × RANKS_PER_NODE.
+#   Each task runs R MPI ranks per node (default 1), with T threads per rank.
 #   Results append to results/<binary>.csv with file locking.
 #
 # USAGE
 #   bash scripts/run_array_mpi.sh --bin bin/mpi_omp_mmap
 #   bash scripts/run_array_mpi.sh --bin bin/mpi_omp_seq_mmap --max-parallel 2
+#   bash scripts/run_array_mpi.sh --bin bin/mpi_omp_mmap --args "-m shm" --tag shm
+#   (--args is forwarded to the binary; --tag makes results go to results/<binary>_<tag>.csv)
 #
 # LOGGING
 #   Single .out/.err per array (per NODES value): logs/<bin>_N<NODES>_%A.out / .err (append).
@@ -31,6 +33,7 @@ PAYLOAD_MAX=(8 32 128)
 CUTOFFS=(10000)
 THREADS=(1 2 4 8 16 32)        # threads per MPI rank
 NODES=(1 2)                    # we submit one array per value here
+RANKS_PER_NODE=(1)             # e.g. (1 2 4) with "-m shm" to share a node between ranks
 
 # Optional safety: set to your cluster's cores per node (e.g., 32 or 64).
 # If >0, tasks with T > CORES_PER_NODE are skipped to avoid oversubscription.
@@ -45,6 +48,8 @@ mode="submit"
 max_parallel="1"               # array throttle within each NODES array
 BIN=""                         # e.g., bin/mpi_omp_mmap
 nodes_fixed=""                 # passed to workers so they know their NODES value
+EXTRA_ARGS=""                  # extra flags forwarded to the binary (e.g. "-m shm")
+TAG=""                         # optional results suffix
 
 # ------------------------- ARG PARSING ---------------------------
 while [[ $# -gt 0 ]]; do
@@ -53,21 +58,27 @@ while [[ $# -gt 0 ]]; do
     --bin)    BIN="${2:-}"; shift 2 ;;
     --max-parallel) max_parallel="${2:?}"; shift 2 ;;
     --nodes-fixed) nodes_fixed="${2:-}"; shift 2 ;;   # internal (worker)
-    *) echo "Usage: $0 --bin bin/<mpi-executable> [--max-parallel N]" >&2; exit 1 ;;
+    --args)   EXTRA_ARGS="${2:-}"; shift 2 ;;
+    --tag)    TAG="${2:-}"; shift 2 ;;
+    *) echo "Usage: $0 --bin bin/<mpi-executable> [--max-parallel N] [--args \"...\"] [--tag NAME]" >&2; exit 1 ;;
   esac
 done
 
 [[ -n "$BIN" ]] || { echo "ERROR: --bin is required"; exit 2; }
 [[ "$BIN" == */* ]] || BIN="./bin/$BIN"
 BIN_BASENAME="$(basename "$BIN")"
-OUTCSV="results/${BIN_BASENAME}.csv"
+OUTCSV="results/${BIN_BASENAME}${TAG:+_$TAG}.csv"
 
 # Numeric max of THREADS (used for cpus-per-task per array)
 max_threads="${THREADS[0]}"
 for v in "${THREADS[@]}"; do (( v > max_threads )) && max_threads="$v"; done
 
+# Numeric max of RANKS_PER_NODE (used for ntasks-per-node per array)
+max_rpn="${RANKS_PER_NODE[0]}"
+for v in "${RANKS_PER_NODE[@]}"; do (( v > max_rpn )) && max_rpn="$v"; done
+
 calc_total_per_nodes() {
-  echo $(( ${#TRIALS[@]} * ${#RECORDS[@]} * ${#PAYLOAD_MAX[@]} * ${#CUTOFFS[@]} * ${#THREADS[@]} ))
+  echo $(( ${#TRIALS[@]} * ${#RECORDS[@]} * ${#PAYLOAD_MAX[@]} * ${#CUTOFFS[@]} * ${#THREADS[@]} * ${#RANKS_PER_NODE[@]} ))
 }
 
 # ------------------------- SUBMIT MODE ---------------------------
@@ -84,6 +95,7 @@ if [[ "$mode" == "submit" ]]; then
       --parsable                          # echo just the JobID so we can capture it
       --array=0-$((total_each-1))%${max_parallel}
       --nodes="${nn}"
+      --ntasks-per-node="${max_rpn}"
       --cpus-per-task="${max_threads}"
       --job-name="grid"
       --output="logs/${BIN_BASENAME}_N${nn}_%A.out"
@@ -97,7 +109,7 @@ if [[ "$mode" == "submit" ]]; then
     fi
 
     # Submit and capture the new JobID
-    jid="$("${cmd[@]}" "$SCRIPT_PATH" --worker --bin "$BIN" --nodes-fixed "${nn}")"
+    jid="$("${cmd[@]}" "$SCRIPT_PATH" --worker --bin "$BIN" --nodes-fixed "${nn}" --args "$EXTRA_ARGS" --tag "$TAG")"
     echo "Submitted NODES=${nn} as JobID ${jid}"
     prev_jid="$jid"
   done
@@ -116,47 +128,52 @@ NR=${#RECORDS[@]}
 NP=${#PAYLOAD_MAX[@]}
 NC=${#CUTOFFS[@]}
 NTH=${#THREADS[@]}
+NRPN=${#RANKS_PER_NODE[@]}
 
 COMB_RP=$(( NR * NP ))
 COMB_RPC=$(( COMB_RP * NC ))
-COMB_RPCT=$(( COMB_RPC * NTH ))
+COMB_RPCT=$(( COMB_RPC * NTH * NRPN ))
 
 idx=$SLURM_ARRAY_TASK_ID
 ti=$(( idx / COMB_RPCT ))
 rem=$(( idx % COMB_RPCT ))
-ri=$(( rem / (NP * NC * NTH) ))
-rem=$(( rem % (NP * NC * NTH) ))
-pi=$(( rem / (NC * NTH) ))
-rem=$(( rem % (NC * NTH) ))
-ci=$(( rem / NTH ))
-thi=$(( rem % NTH ))
+ri=$(( rem / (NP * NC * NTH * NRPN) ))
+rem=$(( rem % (NP * NC * NTH * NRPN) ))
+pi=$(( rem / (NC * NTH * NRPN) ))
+rem=$(( rem % (NC * NTH * NRPN) ))
+ci=$(( rem / (NTH * NRPN) ))
+rem=$(( rem % (NTH * NRPN) ))
+thi=$(( rem / NRPN ))
+rpi=$(( rem % NRPN ))
 
 trial="${TRIALS[$ti]}"
 n="${RECORDS[$ri]}"
 p="${PAYLOAD_MAX[$pi]}"
 c="${CUTOFFS[$ci]}"
 T="${THREADS[$thi]}"
+RPN="${RANKS_PER_NODE[$rpi]}"
 
 # Optional safety: skip combos that don't fit on the node
-if (( CORES_PER_NODE > 0 && T > CORES_PER_NODE )); then
-  echo "[task $SLURM_ARRAY_TASK_ID] SKIP: T=$T > CORES_PER_NODE=$CORES_PER_NODE (nodes=$nodes_fixed)" 
+if (( CORES_PER_NODE > 0 && T * RPN > CORES_PER_NODE )); then
+  echo "[task $SLURM_ARRAY_TASK_ID] SKIP: T=$T x RPN=$RPN > CORES_PER_NODE=$CORES_PER_NODE (nodes=$nodes_fixed)" 
   exit 0
 fi
 
-# Hybrid: one rank per node, T threads per rank
+# Hybrid: RPN ranks per node, T threads per rank
 export OMP_NUM_THREADS="$T"
-ranks="$nodes_fixed"     # one rank on each node
+ranks=$(( nodes_fixed * RPN ))
 
-echo "[task $SLURM_ARRAY_TASK_ID] bin=$BIN_BASENAME trial=$trial N=$n P=$p C=$c T=$T NODES=$nodes_fixed RANKS=$ranks"
+echo "[task $SLURM_ARRAY_TASK_ID] bin=$BIN_BASENAME trial=$trial N=$n P=$p C=$c T=$T NODES=$nodes_fixed RANKS=$ranks ARGS=$EXTRA_ARGS"
 
 tmplog="$(mktemp)"
 
 # Build srun options (add --mpi if specified)
-SRUN_OPTS=( --exclusive -N "$nodes_fixed" --ntasks-per-node=1 --cpus-per-task="$T" --cpu-bind=cores )
+SRUN_OPTS=( --exclusive -N "$nodes_fixed" --ntasks-per-node="$RPN" --cpus-per-task="$T" --cpu-bind=cores )
 [[ -n "$MPI_PLUGIN" ]] && SRUN_OPTS+=( --mpi="$MPI_PLUGIN" )
 
 # launch, capture both stdout+stderr, mirror to .out
-if srun "${SRUN_OPTS[@]}" "$BIN" -n "$n" -p "$p" -c "$c" -t "$T" >"$tmplog" 2>&1; then
+# shellcheck disable=SC2086  # EXTRA_ARGS is intentionally word-split
+if srun "${SRUN_OPTS[@]}" "$BIN" -n "$n" -p "$p" -c "$c" -t "$T" $EXTRA_ARGS >"$tmplog" 2>&1; then
   : # ok
 else
   echo "[task $SLURM_ARRAY_TASK_ID] WARNING: program exited non-zero" >&2
@@ -172,16 +189,17 @@ rd_ms="$( echo "$OUT" | grep -m1 -E '\[reading[[:space:]]*\]'              | gre
 rs_ms="$( echo "$OUT" | grep -m1 -E '\[reading_and_sorting[[:space:]]*\]'  | grep -oE "$num" | head -n1 || echo 0)"
 wr_ms="$( echo "$OUT" | grep -m1 -E '\[writing[[:space:]]*\]'              | grep -oE "$num" | head -n1 || echo 0)"
 chk_ms="$(echo "$OUT" | grep -m1 -E '\[check_if_sorted[[:space:]]*\]'      | grep -oE "$num" | head -n1 || echo 0)"
+ckp_ms="$(echo "$OUT" | grep -m1 -E '\[checkpoint[[:space:]]*\]'           | grep -oE "$num" | head -n1 || echo 0)"
 sorted=0; echo "$OUT" | grep -q 'File is sorted\.' && sorted=1
 
 # ----------------------------- CSV output -----------------------------------
 flock -x "$OUTCSV" -c '
   if [[ ! -s "'"$OUTCSV"'" ]]; then
-    printf "trial,records,payload_max,cutoff,threads,nodes,total_ranks,generate_unsorted_ms,reading_ms,reading_and_sorting_ms,writing_ms,check_if_sorted_ms,sorted\n" > "'"$OUTCSV"'"
+    printf "trial,records,payload_max,cutoff,threads,nodes,total_ranks,generate_unsorted_ms,reading_ms,reading_and_sorting_ms,writing_ms,check_if_sorted_ms,checkpoint_ms,sorted\n" > "'"$OUTCSV"'"
   fi
-  printf "%s,%s,%s,%s,%s,%s,%s,%.3f,%.3f,%.3f,%.3f,%.3f,%d\n" \
+  printf "%s,%s,%s,%s,%s,%s,%s,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%d\n" \
     "'"$trial"'" "'"$n"'" "'"$p"'" "'"$c"'" "'"$T"'" "'"$nodes_fixed"'" "'"$ranks"'" \
-    '"${gen_ms:-0}"' '"${rd_ms:-0}"' '"${rs_ms:-0}"' '"${wr_ms:-0}"' '"${chk_ms:-0}"' '"$sorted"' >> "'"$OUTCSV"'"
+    '"${gen_ms:-0}"' '"${rd_ms:-0}"' '"${rs_ms:-0}"' '"${wr_ms:-0}"' '"${chk_ms:-0}"' '"${ckp_ms:-0}"' '"$sorted"' >> "'"$OUTCSV"'"
 '
 
 echo "[task $SLURM_ARRAY_TASK_ID] done → $OUTCSV"
@@ -8,12 +8,12 @@ int main(int argc, char** argv)
 
     // Phase 1 - streaming generation
     BENCH_START(generate_unsorted);
-    std::string unsorted_file = generate_unsorted_file_mmap(opt.n_records, opt.payload_max);
+    std::string unsorted_file = generate_unsorted_file_mmap(opt.n_records, opt.payload_max, opt.format);
     BENCH_STOP(generate_unsorted);
 
     // Phase 2 - build index
     BENCH_START(reading_and_sorting);
-    IndexRec*   idx   = build_index_mmap(unsorted_file, opt.n_records);
+    IndexRec*   idx   = build_index_mmap(unsorted_file, opt.n_records, opt.direct);
 
     // Phase 3 - sort index in RAM
     sort_records(idx, opt.n_records);
@@ -23,7 +23,7 @@ int main(int argc, char** argv)
     BENCH_START(writing);
     rewrite_sorted_mmap(unsorted_file, "files/sorted_"
                      + std::to_string(opt.n_records) + "_"
-                     + std::to_string(opt.payload_max) + ".bin", idx, opt.n_records);
+                     + std::to_string(opt.payload_max) + ".bin", idx, opt.n_records, opt.rewrite, opt.window_mb);
     BENCH_STOP(writing);
 
     // Phase 5 - verify
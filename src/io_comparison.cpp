@@ -15,506 +15,449 @@
 #include <cstdlib>
 #include <string>
 
-static std::string generate_unsorted_file_streaming(std::size_t    total_n,
-                                                    std::uint32_t payload_max)
+#ifdef HAVE_LIBURING               // make io_comparison URING=1
+#include <liburing.h>
+#endif
+
+// The write section produces the default record layout {8B key, 4B len, payload}
+static_assert(REC_KEY_BITS == 64 && REC_LEN_BITS == 32, "io_comparison: default record schema only");
+
+// I/O strategy benchmark
+//   io_comparison <num_records> <max_payload> [write|scan|gather|all]
+// write : five ways to write the same pre-generated records (streaming, stdio,
+//         setvbuf, mmap+fallocate, O_DIRECT), each timed up to fdatasync
+// scan  : sequential read of the input with mmap, read(), O_DIRECT and io_uring,
+//         then the two real index scans (build_index_mmap, --direct)
+// gather: the rewrite strategies of the drivers (--rewrite gather|scatter|window|async)
+// Every line reports time, GB/s and IOPS, where an op is one I/O request
+// (one page for mmap) or, for index scans and gathers, one record.
+// The input is dropped from the page cache before each scan and gather
+// (best effort: fdatasync + POSIX_FADV_DONTNEED).
+
+// Write strategies
+// The records are generated once, before any timer, into one buffer in file
+// order; every strategy then writes that same byte stream its own way and
+// ends with fdatasync, so the timings cover the write path down to storage
+// and not the random number generator or the page cache.
+constexpr std::size_t HDR_SZ = sizeof(unsigned long) + sizeof(uint32_t);
+
+struct Records {
+    std::vector<char>     bytes;    // {key, len, payload} back to back
+    std::vector<uint32_t> lens;     // payload length per record
+};
+
+static Records make_records(std::size_t total_n, std::uint32_t payload_max)
 {
-    namespace fs = std::filesystem;
-    fs::create_directories("files");
-
-    std::string path = "files/a_unsorted_"
-                     + std::to_string(total_n) + "_"
-                     + std::to_string(payload_max) + ".bin";
-
-    if (fs::exists(path)) {
-        std::cout << "Skipping gen; found “" << path << "”.\n";
-        return path;
-    }
-
-    // Open file for streaming writes
-    int fd = ::open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
-    if (fd < 0) {
-        std::perror("open");
-        std::exit(1);
-    }
-
-    // I/O buffer (1 GiB), flush when >= 512 MiB
-    constexpr std::size_t IO_BUF_SZ    = 1 << 30;
-    constexpr std::size_t FLUSH_THRESH = 512 << 20; // 512 MiB
-    std::vector<char> io_buf;
-    io_buf.reserve(IO_BUF_SZ);
-
-    // Payload scratch buffer
-    std::vector<char> payload_buf(payload_max);
-
-    // RNG setup
     std::mt19937                    rng{42};
     std::uniform_int_distribution<> key_gen(0, INT32_MAX);
     std::uniform_int_distribution<> len_gen(8, payload_max);
     std::uniform_int_distribution<> byte_gen(0, 255);
 
-    // Generate records into io_buf, flush in big batches
+    Records recs;
+    recs.lens.resize(total_n);
+    std::size_t exact_size = 0;
     for (std::size_t i = 0; i < total_n; ++i) {
-        
-        // inside your loop, *instead* of RecHdr hdr + single insert:
-        unsigned long key = static_cast<unsigned long>( key_gen(rng) );
-        uint32_t      len = static_cast<uint32_t>      ( len_gen(rng) );
-
-        // fill payload_buf[0..len)
-        for (uint32_t j = 0; j < len; ++j)
-            payload_buf[j] = static_cast<char>(byte_gen(rng));
-
-        // pack header into a small on-stack buffer
-        char hdr_buf[sizeof(key) + sizeof(len)];
-        std::memcpy(hdr_buf,             &key, sizeof(key));
-        std::memcpy(hdr_buf + sizeof(key), &len,  sizeof(len));
-
-        // append header bytes
-        io_buf.insert(io_buf.end(), hdr_buf, hdr_buf + sizeof(hdr_buf));
-
-        // append payload bytes
-        io_buf.insert(io_buf.end(),
-                    payload_buf.data(),
-                    payload_buf.data() + len);
-
-        // flush if buffer is big
-        if (io_buf.size() >= FLUSH_THRESH) {
-            ssize_t w = ::write(fd, io_buf.data(), io_buf.size());
-            if (w < 0 || static_cast<size_t>(w) != io_buf.size()) {
-                std::perror("write");
-                ::close(fd);
-                std::exit(1);
-            }
-            io_buf.clear();
-        }
+        recs.lens[i] = static_cast<uint32_t>(len_gen(rng));
+        exact_size  += HDR_SZ + recs.lens[i];
     }
-
-    // flush any remaining data
-    if (!io_buf.empty()) {
-        ssize_t w = ::write(fd, io_buf.data(), io_buf.size());
-        if (w < 0 || static_cast<size_t>(w) != io_buf.size()) {
-            std::perror("write final");
-            ::close(fd);
-            std::exit(1);
-        }
+    recs.bytes.resize(exact_size);
+    char* p = recs.bytes.data();
+    for (std::size_t i = 0; i < total_n; ++i) {
+        const unsigned long key = static_cast<unsigned long>(key_gen(rng));
+        const uint32_t      len = recs.lens[i];
+        std::memcpy(p,               &key, sizeof(key));
+        std::memcpy(p + sizeof(key), &len, sizeof(len));
+        for (uint32_t j = 0; j < len; ++j) p[HDR_SZ + j] = static_cast<char>(byte_gen(rng));
+        p += HDR_SZ + len;
     }
-
-    ::close(fd);
-    std::cout << "Generated “" << path << "”.\n";
-    return path;
+    return recs;
 }
 
-static std::string generate_unsorted_file_stdio(std::size_t total_n,
-                                          std::uint32_t payload_max)
+static void sync_or_die(int fd)
 {
-    // 1) ensure output folder
-    std::filesystem::create_directories("files");
-
-    // 2) cache-keyed filename
-    std::string path = "files/b_unsorted_"
-                     + std::to_string(total_n) + "_"
-                     + std::to_string(payload_max) + ".bin";
-
-    // 3) skip if already exists
-    if (std::filesystem::exists(path)) {
-        std::cout << "Found existing unsorted file (“" << path 
-                  << "”) – skipping generation.\n";
-        return path;
-    }
-
-    // 4) open for binary writing
-    std::ofstream fout(path, std::ios::binary | std::ios::trunc);
-    if (!fout) {
-        std::perror("opening unsorted file");
-        std::exit(1);
-    }
-
-    // 5) set up RNG & distributions
-    std::mt19937                      rng{42};
-    std::uniform_int_distribution<>  key_gen(0, INT32_MAX);
-    std::uniform_int_distribution<>  len_gen(8, payload_max);
-    std::uniform_int_distribution<>  byte_gen(0, 255);
-
-    // 6) one reusable buffer for payload bytes
-    std::vector<char> buffer(payload_max);
-
-    // tune the ofstream's write-buffer
-    std::vector<char> io_buf(512 << 10);       // 512 KiB
-
-    std::cout << "Streaming-generating " << total_n 
-              << " records into “" << path << "”…\n";
+    if (fdatasync(fd) < 0) { std::perror("fdatasync"); std::exit(1); }
+}
 
-    // 7) generate-and-write loop
-    for (std::size_t i = 0; i < total_n; ++i) {
-        unsigned long key = static_cast<unsigned long>(key_gen(rng));
-        uint32_t len    = static_cast<uint32_t>(len_gen(rng));
+// 1) streaming write(): records appended to a user buffer, flushed in big batches
+static void write_streaming(const Records& recs, const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) { std::perror("open"); std::exit(1); }
 
-        // fill buffer[0..len)
-        for (uint32_t j = 0; j < len; ++j)
-            buffer[j] = static_cast<char>(byte_gen(rng));
+    constexpr std::size_t FLUSH_THRESH = 512 << 20; // 512 MiB
+    std::vector<char> io_buf;
+    io_buf.reserve(std::min(recs.bytes.size(), FLUSH_THRESH + HDR_SZ + (1u << 20)));
 
-        // write key, len, payload
-        fout.write(reinterpret_cast<const char*>(&key), sizeof(key));
-        fout.write(reinterpret_cast<const char*>(&len),   sizeof(len));
-        fout.write(buffer.data(),                         len);
+    auto flush = [&] {
+        ssize_t w = ::write(fd, io_buf.data(), io_buf.size());
+        if (w < 0 || static_cast<size_t>(w) != io_buf.size()) { std::perror("write"); std::exit(1); }
+        io_buf.clear();
+    };
+    const char* p = recs.bytes.data();
+    for (uint32_t len : recs.lens) {
+        io_buf.insert(io_buf.end(), p, p + HDR_SZ + len);
+        p += HDR_SZ + len;
+        if (io_buf.size() >= FLUSH_THRESH) flush();
     }
+    if (!io_buf.empty()) flush();
 
-    std::cout << "Unsorted file ready: “" << path << "”.\n";
-    return path;
+    sync_or_die(fd);
+    ::close(fd);
 }
 
-
-
-static std::string generate_unsorted_file_setvbuf(std::size_t total_n,
-                                          std::uint32_t payload_max)
+// 2) std::ofstream: key, len and payload written field by field
+static void write_stdio(const Records& recs, const std::string& path)
 {
-    // 1) ensure output folder
-    std::filesystem::create_directories("files");
-
-    // 2) cache-keyed filename
-    std::string path = "files/c_unsorted_"
-                     + std::to_string(total_n) + "_"
-                     + std::to_string(payload_max) + ".bin";
-
-    // 3) skip if already exists
-    if (std::filesystem::exists(path)) {
-        std::cout << "Found existing unsorted file (\"" << path 
-                  << "\") – skipping generation.\n";
-        return path;
+    std::vector<char> io_buf(512 << 10);       // 512 KiB ofstream buffer
+    std::ofstream fout;
+    fout.rdbuf()->pubsetbuf(io_buf.data(), io_buf.size());
+    fout.open(path, std::ios::binary | std::ios::trunc);
+    if (!fout) { std::perror("opening unsorted file"); std::exit(1); }
+
+    const char* p = recs.bytes.data();
+    for (uint32_t len : recs.lens) {
+        fout.write(p,                          sizeof(unsigned long));
+        fout.write(p + sizeof(unsigned long),  sizeof(uint32_t));
+        fout.write(p + HDR_SZ,                 len);
+        p += HDR_SZ + len;
     }
+    fout.close();
+    if (!fout) { std::perror("ofstream write"); std::exit(1); }
 
-    // 4) open for binary writing via C stdio
+    int fd = ::open(path.c_str(), O_WRONLY);
+    if (fd < 0) { std::perror("open"); std::exit(1); }
+    sync_or_die(fd);
+    ::close(fd);
+}
+
+// 3) stdio with setvbuf at the file system block size, one fwrite per record
+static void write_setvbuf(const Records& recs, const std::string& path)
+{
     FILE* f = std::fopen(path.c_str(), "wb");
-    if (!f) {
-        std::perror("opening unsorted file");
-        std::exit(1);
-    }
+    if (!f) { std::perror("opening unsorted file"); std::exit(1); }
 
     struct stat stats;
-    if (fstat(fileno(f), &stats) == -1) // POSIX only
-    {
-        std::perror("fstat");
-        exit(1);
-    }
- 
-    std::cout << "BUFSIZ is " << BUFSIZ << ", but optimal block size is "
-              << stats.st_blksize << '\n';
-
-    // 5) tune the stdio buffer to 512 KiB
-    std::vector<char> io_buf(512 << 10);
+    if (fstat(fileno(f), &stats) == -1) { std::perror("fstat"); std::exit(1); }
     if (std::setvbuf(f, nullptr, _IOFBF, stats.st_blksize) != 0) {
         std::perror("setvbuf");
-        std::fclose(f);
         std::exit(1);
     }
 
-    // 6) set up RNG & distributions
-    std::mt19937                     rng{42};
-    std::uniform_int_distribution<>  key_gen(0, INT32_MAX);
-    std::uniform_int_distribution<>  len_gen(8, payload_max);
-    std::uniform_int_distribution<>  byte_gen(0, 255);
-
-    // 7) one reusable buffer for payload bytes
-    std::vector<char> buffer(payload_max);
-
-    std::cout << "Streaming-generating " << total_n 
-              << " records into \"" << path << "\"…\n";
-
-    // right after you open f …
-    // size of key+len header
-    constexpr std::size_t HDR_SZ = sizeof(unsigned long) + sizeof(uint32_t);
-    // record buffer big enough for header + max payload
-    std::vector<char> rec_buf(HDR_SZ + payload_max);
-
-    
-    // 8) generate-and-write loop
-    for (std::size_t i = 0; i < total_n; ++i) {
-            // 1) draw key & len
-        unsigned long key = static_cast<unsigned long>(key_gen(rng));
-        uint32_t      len = static_cast<uint32_t>(len_gen(rng));
-
-        // 2) pack header
-        std::memcpy(rec_buf.data(),              &key, sizeof(key));
-        std::memcpy(rec_buf.data() + sizeof(key), &len, sizeof(len));
-
-        // 3) fill payload directly into rec_buf
-        for (uint32_t j = 0; j < len; ++j) {
-            rec_buf[HDR_SZ + j] = static_cast<char>(byte_gen(rng));
-        }
-
-        // 4) write exactly one buffer per record
-        std::size_t rec_sz = HDR_SZ + len;
-        if (std::fwrite(rec_buf.data(), 1, rec_sz, f) != rec_sz) {
-            std::perror("fwrite");
-            std::fclose(f);
-            std::exit(1);
-        }
+    const char* p = recs.bytes.data();
+    for (uint32_t len : recs.lens) {
+        const std::size_t rec_sz = HDR_SZ + len;
+        if (std::fwrite(p, 1, rec_sz, f) != rec_sz) { std::perror("fwrite"); std::exit(1); }
+        p += rec_sz;
     }
-
-    // 9) clean up
+    if (std::fflush(f) != 0) { std::perror("fflush"); std::exit(1); }
+    sync_or_die(fileno(f));
     std::fclose(f);
-    std::cout << "Unsorted file ready: \"" << path << "\".\n";
-    return path;
 }
 
-static std::string generate_unsorted_file_mmap(std::size_t total_n,
-                                               std::uint32_t payload_max)
+// 4) posix_fallocate + write-only mapping, one memcpy per record
+static void write_fallocate(const Records& recs, const std::string& path)
 {
-    namespace fs = std::filesystem;
-    fs::create_directories("files");
-
-    std::string path = "files/d_unsorted_"
-                     + std::to_string(total_n) + "_"
-                     + std::to_string(payload_max) + ".bin";
-
-    if (fs::exists(path)) {
-        std::cout << "Skipping gen; found “" << path << "”.\n";
-        return path;
-    }
-
-    constexpr std::size_t KEY_SZ = sizeof(unsigned long);
-    constexpr std::size_t LEN_SZ = sizeof(uint32_t);
-
-    // RNG setup
-    std::mt19937                    rng{42};
-    std::uniform_int_distribution<> key_gen(0, INT32_MAX);
-    std::uniform_int_distribution<> len_gen(8, payload_max);
-    std::uniform_int_distribution<> byte_gen(0, 255);
-
-    // 1) Precompute keys & lengths so we know exact file size
-    BENCH_START(generate_arrays);
-    std::vector<unsigned long> keys (total_n);
-    std::vector<uint32_t>      lens (total_n);
-    size_t exact_size = 0;
-    for (size_t i = 0; i < total_n; ++i) {
-        keys[i] = static_cast<unsigned long>( key_gen(rng) );
-        lens[i] = static_cast<uint32_t>      ( len_gen(rng) );
-        exact_size += KEY_SZ + LEN_SZ + lens[i];
-    }
-    BENCH_STOP(generate_arrays);
-
-    BENCH_START(open_fallocate);
-    int fd = ::open(path.c_str(), O_CREAT | O_RDWR, 0644);
-    if (fd < 0) {
-        std::perror("open");
-        std::exit(1);
-    }
+    const std::size_t exact_size = recs.bytes.size();
+    int fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) { std::perror("open"); std::exit(1); }
+    if (exact_size == 0) { ::close(fd); return; }
     if (int err = posix_fallocate(fd, 0, exact_size); err != 0) {
-        std::cerr << "posix_fallocate failed: "
-                  << std::strerror(err) << "\n";
-        ::close(fd);
+        std::cerr << "posix_fallocate failed: " << std::strerror(err) << "\n";
         std::exit(1);
     }
-    BENCH_STOP(open_fallocate);
-
-    // 3) mmap(write-only) the exact_size region
-    BENCH_START(mmap);
-    char* map = static_cast<char*>(
-        mmap(nullptr, exact_size, PROT_WRITE, MAP_SHARED, fd, 0)
-    );
-    if (map == MAP_FAILED) {
-        std::perror("mmap");
-        std::exit(1);
-    }
-    BENCH_STOP(mmap);
-
-    // 4) prepare a single-record buffer: header + max-payload
-    BENCH_START(generate_records);
-    std::vector<char> record_buf(KEY_SZ + LEN_SZ + payload_max);
-    size_t offset = 0;
-
-    for (size_t i = 0; i < total_n; ++i) {
-        unsigned long key = keys[i];
-        uint32_t      len = lens[i];
+    char* map = static_cast<char*>(mmap(nullptr, exact_size, PROT_WRITE, MAP_SHARED, fd, 0));
+    if (map == MAP_FAILED) { std::perror("mmap"); std::exit(1); }
 
-        // fill header into record_buf
-        std::memcpy(record_buf.data(), &key, KEY_SZ);
-        std::memcpy(record_buf.data() + KEY_SZ, &len, LEN_SZ);
-
-        // fill payload bytes
-        for (uint32_t j = 0; j < len; ++j) {
-            record_buf[KEY_SZ + LEN_SZ + j] = static_cast<char>(byte_gen(rng));
-        }
-
-        // one bulk copy into the mmap’d file
-        size_t rec_sz = KEY_SZ + LEN_SZ + len;
-        std::memcpy(map + offset, record_buf.data(), rec_sz);
+    std::size_t offset = 0;
+    for (uint32_t len : recs.lens) {
+        const std::size_t rec_sz = HDR_SZ + len;
+        std::memcpy(map + offset, recs.bytes.data() + offset, rec_sz);
         offset += rec_sz;
     }
-    BENCH_STOP(generate_records);
-
-    // 5) unmap & close
-    BENCH_START(teardown);
+    if (msync(map, exact_size, MS_SYNC) < 0) { std::perror("msync"); std::exit(1); }
     munmap(map, exact_size);
+    sync_or_die(fd);
     ::close(fd);
-    BENCH_STOP(teardown);
-
-    std::cout << "Generated “" << path << "” (" << exact_size << " bytes).\n";
-    return path;
 }
 
-static std::string generate_unsorted_file_odirect(std::size_t total_n,
-                                          std::uint32_t payload_max)
+// 5) O_DIRECT: records packed into an aligned 1 MiB buffer, written in
+//    page multiples (the tail is zero padded, as before)
+static bool write_odirect(const Records& recs, const std::string& path)
 {
-    namespace fs = std::filesystem;
-    // 1) ensure output folder
-    fs::create_directories("files");
-
-    // 2) build filename
-    std::string path = "files/e_unsorted_"
-                     + std::to_string(total_n) + "_"
-                     + std::to_string(payload_max) + ".bin";
-
-    // 3) skip if it exists
-    if (fs::exists(path)) {
-        std::cout << "Found existing file \"" << path << "\" – skipping.\n";
-        return path;
-    }
-
-    // 4) determine alignment (page size)
     const size_t align = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    int fd = ::open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0 && errno == EINVAL) return false;
+    if (fd < 0) { std::perror("open O_DIRECT"); std::exit(1); }
 
-    // 5) open with O_DIRECT
-    int fd = ::open(path.c_str(),
-                    O_CREAT | O_WRONLY | O_TRUNC | O_DIRECT,
-                    0644);
-    if (fd < 0) {
-        std::perror("open O_DIRECT");
-        std::exit(1);
-    }
-
-    // 6) allocate aligned I/O buffer (1 MiB)
     constexpr size_t IO_BUF_SZ = 1 << 20; // 1 MiB
     char* io_buf = nullptr;
     if (posix_memalign(reinterpret_cast<void**>(&io_buf), align, IO_BUF_SZ) != 0) {
         std::perror("posix_memalign");
-        ::close(fd);
         std::exit(1);
     }
-    size_t io_pos = 0;
-
-    // 7) prepare RNG
-    std::mt19937                     rng{42};
-    std::uniform_int_distribution<>  key_gen(0, INT32_MAX);
-    std::uniform_int_distribution<>  len_gen(8, payload_max);
-    std::uniform_int_distribution<>  byte_gen(0, 255);
-
-    // 8) compute header size and allocate record-scratch buffer
-    constexpr std::size_t HDR_SZ = sizeof(unsigned long) + sizeof(uint32_t);
-    std::vector<char>     payload_buf(payload_max);
-
-    std::cout << "Streaming-generating " << total_n
-              << " records into \"" << path << "\" with O_DIRECT…\n";
-
-    // 9) generate & pack records
-    for (std::size_t i = 0; i < total_n; ++i) {
-        unsigned long key = static_cast<unsigned long>(key_gen(rng));
-        uint32_t      len = static_cast<uint32_t>(len_gen(rng));
-
-        // fill payload
-        for (uint32_t j = 0; j < len; ++j) {
-            payload_buf[j] = static_cast<char>(byte_gen(rng));
-        }
+    auto put = [&](size_t write_sz) {
+        ssize_t w = ::write(fd, io_buf, write_sz);
+        if (w < 0 || static_cast<size_t>(w) != write_sz) { std::perror("direct write"); std::exit(1); }
+    };
 
-        // ensure room in io_buf; flush if necessary
-        size_t rec_sz = HDR_SZ + len;
+    size_t      io_pos = 0;
+    const char* p      = recs.bytes.data();
+    for (uint32_t len : recs.lens) {
+        const size_t rec_sz = HDR_SZ + len;
         if (io_pos + rec_sz > IO_BUF_SZ) {
-            // write down to a multiple of align
-            size_t write_sz = io_pos - (io_pos % align);
-            if (write_sz > 0) {
-                ssize_t w = ::write(fd, io_buf, write_sz);
-                if (w < 0 || static_cast<size_t>(w) != write_sz) {
-                    std::perror("direct write");
-                    free(io_buf);
-                    ::close(fd);
-                    std::exit(1);
-                }
-            }
-            // shift leftover
-            size_t rem = io_pos - write_sz;
-            if (rem > 0) {
-                std::memmove(io_buf, io_buf + write_sz, rem);
-            }
+            // write down to a multiple of align, keep the leftover
+            const size_t write_sz = io_pos - (io_pos % align);
+            if (write_sz > 0) put(write_sz);
+            const size_t rem = io_pos - write_sz;
+            if (rem > 0) std::memmove(io_buf, io_buf + write_sz, rem);
             io_pos = rem;
         }
-
-        // pack header
-        std::memcpy(io_buf + io_pos, &key, sizeof(key));
-        std::memcpy(io_buf + io_pos + sizeof(key), &len, sizeof(len));
-        // pack payload
-        std::memcpy(io_buf + io_pos + HDR_SZ, payload_buf.data(), len);
+        std::memcpy(io_buf + io_pos, p, rec_sz);
         io_pos += rec_sz;
+        p      += rec_sz;
     }
-
-    // 10) final flush (pad up to block size)
     if (io_pos > 0) {
-        size_t write_sz = ((io_pos + align - 1) / align) * align;
-        // zero pad
+        const size_t write_sz = ((io_pos + align - 1) / align) * align;
         std::memset(io_buf + io_pos, 0, write_sz - io_pos);
-        ssize_t w = ::write(fd, io_buf, write_sz);
-        if (w < 0 || static_cast<size_t>(w) != write_sz) {
-            std::perror("final direct write");
-            free(io_buf);
-            ::close(fd);
-            std::exit(1);
-        }
+        put(write_sz);
     }
 
-    // 11) cleanup
     free(io_buf);
+    sync_or_die(fd);   // O_DIRECT bypasses the cache, but not the metadata
     ::close(fd);
-    std::cout << "Unsorted file ready: \"" << path << "\".\n";
-    return path;
+    return true;
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <num_records> <max_payload>\n";
-        return 1;
+// Scan and gather strategies
+constexpr std::size_t SCAN_BLOCK = 4u << 20;   // bytes per read request
+constexpr unsigned    URING_QD   = 8;          // io_uring reads in flight
+
+struct IoResult {
+    double        ms    = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t ops   = 0;
+};
+
+static void report(const char* tag, const IoResult& r)
+{
+    const double s = r.ms / 1000.0;
+    std::printf("[%-20s] %10.3f ms %9.3f GB/s %12.0f IOPS\n",
+                tag, r.ms, r.bytes / s / 1e9, r.ops / s);
+}
+
+static double ms_since(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static void drop_cache(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+}
+
+static std::uint64_t file_size(int fd)
+{
+    struct stat st{};
+    if (fstat(fd, &st) < 0) { std::perror("fstat"); std::exit(1); }
+    return static_cast<std::uint64_t>(st.st_size);
+}
+
+// Touch one byte per page of a read-only mapping
+static IoResult scan_mmap(const std::string& path)
+{
+    IoResult r;
+    const auto t0 = std::chrono::steady_clock::now();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { std::perror("open"); std::exit(1); }
+    r.bytes = file_size(fd);
+    const char* map = static_cast<const char*>(mmap(nullptr, r.bytes, PROT_READ, MAP_SHARED, fd, 0));
+    if (map == MAP_FAILED) { std::perror("mmap"); std::exit(1); }
+    madvise(const_cast<char*>(map), r.bytes, MADV_SEQUENTIAL);
+    const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    volatile unsigned char sink = 0;
+    for (std::uint64_t at = 0; at < r.bytes; at += page, ++r.ops) sink = sink + map[at];
+    munmap(const_cast<char*>(map), r.bytes);
+    ::close(fd);
+    r.ms = ms_since(t0);
+    return r;
+}
+
+// read() / O_DIRECT pread of SCAN_BLOCK-sized blocks; false if O_DIRECT is unsupported
+static bool scan_pread(const std::string& path, bool direct, IoResult& r)
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    int fd = ::open(path.c_str(), O_RDONLY | (direct ? O_DIRECT : 0));
+    if (fd < 0 && direct && errno == EINVAL) return false;
+    if (fd < 0) { std::perror("open"); std::exit(1); }
+    char* buf = static_cast<char*>(std::aligned_alloc(IO_ALIGN, SCAN_BLOCK));
+    if (!buf) { std::perror("aligned_alloc"); std::exit(1); }
+    for (ssize_t rd; (rd = ::pread(fd, buf, SCAN_BLOCK, static_cast<off_t>(r.bytes))) != 0; ++r.ops) {
+        if (rd < 0) { std::perror("pread"); std::exit(1); }
+        r.bytes += rd;
     }
-    std::size_t    total_n     = std::stoull(argv[1]);
-    std::uint32_t payload_max = std::stoul (argv[2]);
+    std::free(buf);
+    ::close(fd);
+    r.ms = ms_since(t0);
+    return true;
+}
 
-    namespace fs = std::filesystem;
+#ifdef HAVE_LIBURING
+// URING_QD block reads in flight, each completion resubmits the next block
+static IoResult scan_uring(const std::string& path)
+{
+    IoResult r;
+    const auto t0 = std::chrono::steady_clock::now();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { std::perror("open"); std::exit(1); }
+    const std::uint64_t size = file_size(fd);
+
+    io_uring ring;
+    if (io_uring_queue_init(URING_QD, &ring, 0) < 0) { std::perror("io_uring_queue_init"); std::exit(1); }
+    std::vector<char*> buf(URING_QD);
+    for (auto& b : buf)
+        if (!(b = static_cast<char*>(std::aligned_alloc(IO_ALIGN, SCAN_BLOCK)))) { std::perror("aligned_alloc"); std::exit(1); }
+
+    std::uint64_t next = 0;
+    unsigned      inflight = 0;
+    auto submit = [&](unsigned slot) {
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_read(sqe, fd, buf[slot], SCAN_BLOCK, next);
+        io_uring_sqe_set_data64(sqe, slot);
+        next += SCAN_BLOCK;
+        ++inflight;
+    };
+    for (unsigned s = 0; s < URING_QD && next < size; ++s) submit(s);
+    io_uring_submit(&ring);
+    while (inflight > 0) {
+        io_uring_cqe* cqe;
+        if (io_uring_wait_cqe(&ring, &cqe) < 0) { std::perror("io_uring_wait_cqe"); std::exit(1); }
+        if (cqe->res < 0) { errno = -cqe->res; std::perror("io_uring read"); std::exit(1); }
+        const unsigned slot = static_cast<unsigned>(io_uring_cqe_get_data64(cqe));
+        r.bytes += cqe->res;
+        ++r.ops;
+        --inflight;
+        io_uring_cqe_seen(&ring, cqe);
+        if (next < size) { submit(slot); io_uring_submit(&ring); }
+    }
+    for (auto* b : buf) std::free(b);
+    io_uring_queue_exit(&ring);
+    ::close(fd);
+    r.ms = ms_since(t0);
+    return r;
+}
+#endif
 
-    // 1) streaming/write()
-    {
-      // ensure we actually regenerate
-      fs::remove("files/a_unsorted_" + std::to_string(total_n) + "_" + std::to_string(payload_max) + ".bin");
-      BENCH_START(stream_write);
-      generate_unsorted_file_streaming(total_n, payload_max);
-      BENCH_STOP(stream_write);
+static void bench_scan(const std::string& path, std::size_t n)
+{
+    IoResult r;
+    drop_cache(path); report("scan_mmap", scan_mmap(path));
+    drop_cache(path); r = {}; scan_pread(path, false, r); report("scan_read", r);
+    drop_cache(path); r = {};
+    if (scan_pread(path, true, r)) report("scan_odirect", r);
+    else std::printf("[%-20s] O_DIRECT not supported here\n", "scan_odirect");
+#ifdef HAVE_LIBURING
+    drop_cache(path); report("scan_uring", scan_uring(path));
+#else
+    std::printf("[%-20s] not built (make io_comparison URING=1)\n", "scan_uring");
+#endif
+
+    // the drivers' index scans (records as ops)
+    std::vector<IndexRec> idx(n);
+    for (std::size_t depth : { std::size_t(0), std::size_t(4) }) {
+        drop_cache(path);
+        const auto t0 = std::chrono::steady_clock::now();
+        build_index_mmap(path, idx.data(), n, 0, nullptr, depth);
+        r.ms = ms_since(t0);
+        r.bytes = std::filesystem::file_size(path);
+        r.ops = n;
+        report(depth ? "index_direct" : "index_mmap", r);
     }
+}
 
-    // 2) stdio/fwrite()
-    {
-      fs::remove("files/b_unsorted_" + std::to_string(total_n) + "_" + std::to_string(payload_max) + ".bin");
-      BENCH_START(stdio_fwrite);
-      generate_unsorted_file_stdio(total_n, payload_max);
-      BENCH_STOP(stdio_fwrite);
+static void bench_gather(const std::string& path, std::size_t n)
+{
+    IndexRec* idx = build_index_mmap(path, n);
+    sort_records(idx, n);
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { std::perror("open"); std::exit(1); }
+    const std::uint64_t size = file_size(fd);
+    const char* in_map = static_cast<const char*>(mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0));
+    if (in_map == MAP_FAILED) { std::perror("mmap"); std::exit(1); }
+    const RecLayout   lay = record_layout(in_map, size);
+    const std::string out = "files/io_sorted.bin";
+
+    for (const char* how : { "gather", "scatter", "window", "async" }) {
+        drop_cache(path);
+        const auto t0 = std::chrono::steady_clock::now();
+        const std::string s = how;
+        const bool ok = s == "scatter" ? scatter_sorted_records(in_map, lay, idx, n, out)
+                      : s == "window"  ? window_sorted_records(fd, lay, idx, n, out, 64u << 20)
+                      : s == "async"   ? async_sorted_records(in_map, lay, idx, n, out)
+                      :                  write_sorted_records(in_map, lay, idx, n, out);
+        int fd_out = ::open(out.c_str(), O_RDONLY);   // count the write-back too
+        if (fd_out >= 0) { fdatasync(fd_out); ::close(fd_out); }
+        IoResult r{ ms_since(t0), size, n };
+        if (!ok) std::exit(1);
+        report((std::string("rewrite_") + how).c_str(), r);
+        ::unlink(out.c_str());
     }
 
-    // 3) setvbuf()
-    {
-      fs::remove("files/c_unsorted_" + std::to_string(total_n) + "_" + std::to_string(payload_max) + ".bin");
-      BENCH_START(setvbuf_fwrite);
-      generate_unsorted_file_setvbuf(total_n, payload_max);
-      BENCH_STOP(setvbuf_fwrite);
+    munmap(const_cast<char*>(in_map), size);
+    ::close(fd);
+    std::free(idx);
+}
+
+
+int main(int argc, char* argv[]) {
+    if (argc != 3 && argc != 4) {
+        std::cerr << "Usage: " << argv[0] << " <num_records> <max_payload> [write|scan|gather|all]\n";
+        return 1;
     }
+    std::size_t    total_n     = std::stoull(argv[1]);
+    std::uint32_t payload_max = std::stoul (argv[2]);
+    const std::string what    = argc == 4 ? argv[3] : "all";
 
-    // 4) mmap + fallocate
-    {
-      fs::remove("files/d_unsorted_" + std::to_string(total_n) + "_" + std::to_string(payload_max) + ".bin");
-      BENCH_START(mmap_fallocate);
-      generate_unsorted_file_mmap(total_n, payload_max);
-      BENCH_STOP(mmap_fallocate);
+    namespace fs = std::filesystem;
+
+    if (what == "scan" || what == "gather" || what == "all") {
+        const std::string input = generate_unsorted_file_mmap(total_n, payload_max);
+        if (what != "gather") bench_scan(input, total_n);
+        if (what != "scan")   bench_gather(input, total_n);
+        if (what != "all") return 0;
+    } else if (what != "write") {
+        std::cerr << "Unknown section " << what << " (write|scan|gather|all)\n";
+        return 1;
     }
 
-    // 5) O_DIRECT
-    {
-      fs::remove("files/e_unsorted_" + std::to_string(total_n) + "_" + std::to_string(payload_max) + ".bin");
-      BENCH_START(odirect_write);
-      generate_unsorted_file_odirect(total_n, payload_max);
-      BENCH_STOP(odirect_write);
+    // Write strategies (records as ops): the records are generated once, then
+    // each strategy writes them to its own file, timed up to fdatasync
+    const Records recs = make_records(total_n, payload_max);
+    const struct { const char* tag; char prefix; void (*write)(const Records&, const std::string&); } writers[] = {
+        { "stream_write",   'a', write_streaming },   // 1) streaming/write()
+        { "stdio_fwrite",   'b', write_stdio     },   // 2) stdio/ofstream
+        { "setvbuf_fwrite", 'c', write_setvbuf   },   // 3) setvbuf()
+        { "mmap_fallocate", 'd', write_fallocate },   // 4) mmap + fallocate
+    };
+    for (const auto& w : writers) {
+        const std::string path = std::string("files/") + w.prefix + "_unsorted_"
+                               + std::to_string(total_n) + "_" + std::to_string(payload_max) + ".bin";
+        const auto t0 = std::chrono::steady_clock::now();
+        w.write(recs, path);
+        report(w.tag, IoResult{ ms_since(t0), recs.bytes.size(), total_n });
+        fs::remove(path);
+    }
+    {   // 5) O_DIRECT
+        const std::string path = "files/e_unsorted_" + std::to_string(total_n) + "_"
+                               + std::to_string(payload_max) + ".bin";
+        const auto t0 = std::chrono::steady_clock::now();
+        if (write_odirect(recs, path)) report("odirect_write", IoResult{ ms_since(t0), recs.bytes.size(), total_n });
+        else std::printf("[%-20s] O_DIRECT not supported here\n", "odirect_write");
+        fs::remove(path);
     }
 
     return 0;
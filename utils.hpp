@@ -7,6 +7,7 @@
 #include <cstdio>               // std::printf, std::puts, std::perror
 #include <string>               // std::string, stoull, stoul, to_string
 #include <cstring>              // std::memcpy
+#include <cerrno>               // errno (O_DIRECT fallback)
 #include <algorithm>            // std::sort, std::inplace_merge
 #include <random>               // std::mt19937, std::uniform_int_distribution
 #include <chrono>               // timing (BENCH_* macros)
@@ -15,6 +16,11 @@
 #include <filesystem>           // create_directories, path ops
 #include <mutex>                // std::mutex, lock_guard, unique_lock
 #include <condition_variable>   // std::condition_variable
+#include <future>               // std::async (run-file merge writer)
+#include <thread>               // std::thread (autotune spawn probe)
+#include <functional>           // std::function (autotune probes)
+#include <cmath>                // std::log2, std::ceil, std::floor
+#include <type_traits>          // std::conditional_t (record schema)
 
 // POSIX
 #include <sys/mman.h>           // mmap, munmap
@@ -23,6 +29,10 @@
 #include <unistd.h>             // close, unlink, ftruncate, getopt
 #include <getopt.h>             // getopt_long, struct option
 
+#ifdef _OPENMP
+#include <omp.h>                // omp_get_max_threads (partition_by_key)
+#endif
+
 
 // Run-time parameters
 struct Params {
@@ -30,6 +40,19 @@ struct Params {
     std::uint32_t payload_max = 256;        // -p
     std::size_t   n_threads   = 0;          // -t   (0 => use hw_concurrency)
     std::size_t   cutoff      = 10'000;     // -c   task-size threshold
+    std::string   merge       = "pairwise"; // -m   distributed merge (MPI drivers): pairwise | shm | rma | kway | multiway
+    bool          compress    = false;      // -z   encode IndexRec streams between ranks / run files
+    std::size_t   dist_chunk  = 0;          // --chunk  MPI slice chunk in records (0 = one-shot)
+    std::string   checkpoint_dir;           // --checkpoint  node-local dir for restartable runs
+    bool          sample      = false;      // -s   split by sampled key ranges (no global merge)
+    std::size_t   run_len     = 0;          // --run  records per sorted run (pipeline drivers, 0 = from N)
+    bool          dag         = false;      // --dag  OpenMP mergesort as a depend() task DAG
+    bool          autotune    = false;      // --autotune  pick cutoff, threads and run length by probing
+    int           format      = 1;          // --format  file format of generated input: 1 (raw) | 2
+    std::string   rewrite     = "gather";   // --rewrite  output strategy: gather | scatter | window | async | auto
+    std::size_t   window_mb   = 64;         // --window  staging memory of --rewrite window (MiB)
+    std::size_t   direct      = 0;          // --direct  O_DIRECT index scan, blocks read ahead (0 = mmap)
+    std::string   key         = "asc";      // --key  sort order and secondary payload fields
 };
 
 
@@ -47,21 +70,224 @@ struct Params {
     } while (0)
 
 
+// Record schema
+// A record is {key, len, payload}. The key type and the width of the on-disk
+// length field are compile-time parameters (make KEY_BITS=32|64|128
+// LEN_BITS=16|32, default 64/32): every binary is built for one schema and the
+// record I/O, run files and generated inputs all follow it, and the index
+// keys derive from it (see Sort keys below). Narrower keys give smaller
+// IndexRec entries (16 bytes with 32-bit keys).
+#ifndef REC_KEY_BITS
+#define REC_KEY_BITS 64
+#endif
+#ifndef REC_LEN_BITS
+#define REC_LEN_BITS 32
+#endif
+static_assert(REC_KEY_BITS == 32 || REC_KEY_BITS == 64 || REC_KEY_BITS == 128, "REC_KEY_BITS: 32 | 64 | 128");
+static_assert(REC_LEN_BITS == 16 || REC_LEN_BITS == 32, "REC_LEN_BITS: 16 | 32");
+
+__extension__ typedef unsigned __int128 uint128_key;
+
+template <class Key, class Len>
+struct RecordSchema {
+    using key_type = Key;
+    using len_type = Len;
+    static constexpr std::size_t   KEY_SZ  = sizeof(Key);
+    static constexpr std::size_t   LEN_SZ  = sizeof(Len);
+    static constexpr std::size_t   HDR     = KEY_SZ + LEN_SZ;
+    static constexpr std::uint64_t MAX_LEN = static_cast<Len>(~Len{0});
+
+    static Key key_at(const char* rec) { Key k; std::memcpy(&k, rec, KEY_SZ); return k; }
+    static std::uint32_t len_at(const char* rec) { Len l; std::memcpy(&l, rec + KEY_SZ, LEN_SZ); return l; }
+    static void put_header(char* dst, Key key, std::uint32_t len) {
+        const Len l = static_cast<Len>(len);
+        std::memcpy(dst, &key, KEY_SZ);
+        std::memcpy(dst + KEY_SZ, &l, LEN_SZ);
+    }
+};
+
+using RecSchema = RecordSchema<
+    std::conditional_t<REC_KEY_BITS == 32, std::uint32_t,
+    std::conditional_t<REC_KEY_BITS == 64, unsigned long, uint128_key>>,
+    std::conditional_t<REC_LEN_BITS == 16, std::uint16_t, std::uint32_t>>;
+
+using rec_key_t = RecSchema::key_type;
+constexpr std::size_t REC_HDR = RecSchema::HDR;
+constexpr rec_key_t   KEY_MAX = static_cast<rec_key_t>(~rec_key_t{0});
+
+// File-name suffix of a non-default schema (its files are not interchangeable)
+static inline std::string schema_tag()
+{
+    if (REC_KEY_BITS == 64 && REC_LEN_BITS == 32) return "";
+    return "_k" + std::to_string(REC_KEY_BITS) + "l" + std::to_string(REC_LEN_BITS);
+}
+
+// Keys for messages (128-bit keys have no std::to_string)
+template <class U>
+static inline std::string key_str(U k)
+{
+    std::string s;
+    do { s.insert(s.begin(), static_cast<char>('0' + static_cast<int>(k % 10))); k /= 10; } while (k);
+    return s;
+}
+
+
+// Sort keys
+// The index orders records by a normalised key. The record key sits in the
+// high bits, inverted for --key desc. With SORT_KEY_BITS wider than the
+// record key (make SORT_KEY_BITS=64|128), the spare low bits hold secondary
+// fields: payload bytes, big-endian, each field optionally inverted. So any
+// --key spec still compares as one integer in sort, merges and splitters,
+// and disk_key() recovers the record key. By default the width is the same
+// and the order ascending, so the normalised key is the record key itself.
+#ifndef SORT_KEY_BITS
+#define SORT_KEY_BITS REC_KEY_BITS
+#endif
+static_assert(SORT_KEY_BITS >= REC_KEY_BITS && (SORT_KEY_BITS == 32 || SORT_KEY_BITS == 64 || SORT_KEY_BITS == 128),
+              "SORT_KEY_BITS: 32 | 64 | 128, at least REC_KEY_BITS");
+
+using sort_key_t = std::conditional_t<SORT_KEY_BITS == 32, std::uint32_t,
+                   std::conditional_t<SORT_KEY_BITS == 64, unsigned long, uint128_key>>;
+constexpr int        SPARE_KEY_BITS = SORT_KEY_BITS - REC_KEY_BITS;   // room for secondary fields
+constexpr sort_key_t SORT_KEY_MAX   = static_cast<sort_key_t>(~sort_key_t{0});
+
+struct KeyField {
+    std::uint32_t off = 0, len = 0;   // payload bytes [off, off + len)
+    bool          desc = false;
+};
+
+struct KeySpec {
+    rec_key_t             mask = 0;   // KEY_MAX: descending record keys
+    std::vector<KeyField> fields;     // secondary fields, most significant first
+};
+
+inline KeySpec g_key_spec;            // --key, set by parse_argv
+
+static inline bool key_less(sort_key_t a, sort_key_t b) { return a < b; }
+
+// --key asc|desc[,OFF:LEN[:asc|desc]]...   e.g. desc,0:4,8:2:desc
+static inline KeySpec parse_key_spec(const std::string& spec)
+{
+    KeySpec     ks;
+    std::size_t bits = 0;
+    std::size_t at   = 0;
+    for (int i = 0; at <= spec.size(); ++i) {
+        const std::size_t end = std::min(spec.find(',', at), spec.size());
+        const std::string tok = spec.substr(at, end - at);
+        at = end + 1;
+        if (i == 0) {
+            if (tok != "asc" && tok != "desc") {
+                std::fprintf(stderr, "Error: --key must start with asc or desc (got %s)\n", spec.c_str());
+                std::exit(1);
+            }
+            ks.mask = tok == "desc" ? KEY_MAX : rec_key_t{0};
+            continue;
+        }
+        KeyField f;
+        char dir[8] = "asc";
+        if (std::sscanf(tok.c_str(), "%u:%u:%7s", &f.off, &f.len, dir) < 2 || f.len == 0 ||
+            (std::strcmp(dir, "asc") != 0 && std::strcmp(dir, "desc") != 0)) {
+            std::fprintf(stderr, "Error: --key field must be OFF:LEN[:asc|desc] (got %s)\n", tok.c_str());
+            std::exit(1);
+        }
+        f.desc = std::strcmp(dir, "desc") == 0;
+        bits  += 8 * static_cast<std::size_t>(f.len);
+        ks.fields.push_back(f);
+    }
+    if (bits > static_cast<std::size_t>(SPARE_KEY_BITS)) {
+        std::fprintf(stderr, "Error: --key fields need %zu bits, this build has %d spare "
+                             "(make SORT_KEY_BITS=... above KEY_BITS=%d)\n", bits, SPARE_KEY_BITS, REC_KEY_BITS);
+        std::exit(1);
+    }
+    return ks;
+}
+
+// Normalised key of a record with key `key` and payload p[0, len)
+static inline sort_key_t norm_key(rec_key_t key, const char* p, std::uint32_t len)
+{
+    sort_key_t k     = static_cast<sort_key_t>(static_cast<rec_key_t>(key ^ g_key_spec.mask)) << SPARE_KEY_BITS;
+    int        shift = SPARE_KEY_BITS;
+    for (const KeyField& f : g_key_spec.fields)
+        for (std::uint32_t b = 0; b < f.len; ++b) {
+            std::uint8_t v = f.off + b < len ? static_cast<std::uint8_t>(p[f.off + b]) : 0;
+            if (f.desc) v = static_cast<std::uint8_t>(~v);
+            shift -= 8;
+            k |= static_cast<sort_key_t>(v) << shift;
+        }
+    return k;
+}
+
+// Payload bytes norm_key may read: the end of the furthest --key field
+static inline std::uint32_t key_fields_end()
+{
+    std::uint32_t end = 0;
+    for (const KeyField& f : g_key_spec.fields) end = std::max(end, f.off + f.len);
+    return end;
+}
+
+static inline sort_key_t sort_key_at(const char* rec)
+{
+    return norm_key(RecSchema::key_at(rec), rec + REC_HDR, RecSchema::len_at(rec));
+}
+
+static inline rec_key_t disk_key(sort_key_t k)
+{
+    return static_cast<rec_key_t>(static_cast<rec_key_t>(k >> SPARE_KEY_BITS) ^ g_key_spec.mask);
+}
+
+
 // Record definition
 struct Record {
-    unsigned long key;      // sorting key
+    rec_key_t     key;      // sorting key
     std::uint32_t len;      // payload length in bytes
     char*         payload;  // malloc-owned
 };
 
 
 // Build index (key + offset)
+// key and len come first so a 32-bit key packs into a 16-byte entry
 struct IndexRec {
-    unsigned long key;      // same as in Record
-    uint64_t      offset; 
+    sort_key_t    key;      // normalised key of the record (see Sort keys)
     uint32_t      len;      // payload length
+    uint64_t      offset;   // input byte offset, or the payload itself (see below)
 };
 
+// Inline payloads
+// A payload that fits in the offset field is stored there instead of the
+// offset: the entry then carries the whole record, so the rewrite emits it
+// from the index alone (sequential write, no random read of the input).
+// len decides the form of each entry, no flag is needed. With small payload
+// sweeps (-p 8) every entry is inline and the input is never read back.
+constexpr uint32_t INLINE_PAYLOAD = sizeof(uint64_t);
+
+static inline bool is_inline(const IndexRec& r) { return r.len <= INLINE_PAYLOAD; }
+
+// Index entry for the record whose header is at rec (byte `offset` of the input)
+static inline IndexRec make_index_rec(const char* rec, uint64_t offset)
+{
+    IndexRec r;
+    r.len    = RecSchema::len_at(rec);
+    r.key    = norm_key(RecSchema::key_at(rec), rec + REC_HDR, r.len);
+    r.offset = offset;
+    if (is_inline(r)) {
+        r.offset = 0;
+        std::memcpy(&r.offset, rec + REC_HDR, r.len);
+    }
+    return r;
+}
+
+// Copy the record of r to dst (header + payload, no padding); returns its size
+static inline std::size_t put_record(char* dst, const IndexRec& r, const char* in_map)
+{
+    if (!is_inline(r)) {
+        std::memcpy(dst, in_map + r.offset, REC_HDR + r.len);
+    } else {
+        RecSchema::put_header(dst, disk_key(r.key), r.len);
+        std::memcpy(dst + REC_HDR, &r.offset, r.len);
+    }
+    return REC_HDR + r.len;
+}
+
 
 // Simple progress gate: wait until at least `need` records are ready, and allow the producer to notify progress
 struct ProgressGate {
@@ -102,12 +328,25 @@ static inline Params parse_argv(int argc, char** argv)
         {"payload",    required_argument, nullptr, 'p'},
         {"threads",    required_argument, nullptr, 't'},
         {"cutoff",     required_argument, nullptr, 'c'},
+        {"merge",      required_argument, nullptr, 'm'},
+        {"compress",   no_argument,       nullptr, 'z'},
+        {"chunk",      required_argument, nullptr, 'C'},
+        {"checkpoint", required_argument, nullptr, 'K'},
+        {"sample",     no_argument,       nullptr, 's'},
+        {"run",        required_argument, nullptr, 'R'},
+        {"dag",        no_argument,       nullptr, 'D'},
+        {"autotune",   no_argument,       nullptr, 'A'},
+        {"format",     required_argument, nullptr, 'F'},
+        {"rewrite",    required_argument, nullptr, 'W'},
+        {"window",     required_argument, nullptr, 'M'},
+        {"direct",     required_argument, nullptr, 'O'},
+        {"key",        required_argument, nullptr, 'Y'},
         {"help",       no_argument,       nullptr, 'h'},
         {nullptr,      0,                 nullptr,  0 }
     };
 
     int c;
-    while ((c = getopt_long(argc, argv, "n:p:t:c:h", long_opts, nullptr)) != -1) {
+    while ((c = getopt_long(argc, argv, "n:p:t:c:m:zsh", long_opts, nullptr)) != -1) {
         switch (c) {
             case 'n':
                 try {
@@ -136,6 +375,11 @@ static inline Params parse_argv(int argc, char** argv)
                     std::fprintf(stderr, "Error: --payload must be ≥ 8 (got %u)\n", opt.payload_max);
                     std::exit(1);
                 }
+                if (opt.payload_max > RecSchema::MAX_LEN) {
+                    std::fprintf(stderr, "Error: --payload exceeds the %d-bit length field (got %u)\n",
+                                 REC_LEN_BITS, opt.payload_max);
+                    std::exit(1);
+                }
                 break;
             case 't':
                 try {
@@ -163,6 +407,89 @@ static inline Params parse_argv(int argc, char** argv)
                     std::exit(1);
                 }
                 break;
+            case 'm':
+                opt.merge = optarg;
+                if (opt.merge != "pairwise" && opt.merge != "shm" && opt.merge != "rma" &&
+                    opt.merge != "kway" && opt.merge != "multiway") {
+                    std::fprintf(stderr, "Error: --merge must be pairwise, shm, rma, kway or multiway (got %s)\n", optarg);
+                    std::exit(1);
+                }
+                break;
+            case 'z':
+                opt.compress = true;
+                break;
+            case 'C':
+                try {
+                    opt.dist_chunk = std::stoull(optarg);
+                } catch (const std::exception&) {
+                    std::fprintf(stderr, "Error: --chunk not a number (%s)\n", optarg);
+                    std::exit(1);
+                }
+                break;
+            case 'K':
+                opt.checkpoint_dir = optarg;
+                break;
+            case 's':
+                opt.sample = true;
+                break;
+            case 'R':
+                try {
+                    opt.run_len = std::stoull(optarg);
+                } catch (const std::exception&) {
+                    std::fprintf(stderr, "Error: --run not a number (%s)\n", optarg);
+                    std::exit(1);
+                }
+                if (opt.run_len == 0) {
+                    std::fprintf(stderr, "Error: --run must be > 0\n");
+                    std::exit(1);
+                }
+                break;
+            case 'D':
+                opt.dag = true;
+                break;
+            case 'A':
+                opt.autotune = true;
+                break;
+            case 'F':
+                if      (std::string(optarg) == "v1" || std::string(optarg) == "1") opt.format = 1;
+                else if (std::string(optarg) == "v2" || std::string(optarg) == "2") opt.format = 2;
+                else {
+                    std::fprintf(stderr, "Error: --format must be v1 or v2 (got %s)\n", optarg);
+                    std::exit(1);
+                }
+                break;
+            case 'W':
+                opt.rewrite = optarg;
+                if (opt.rewrite != "gather" && opt.rewrite != "scatter" &&
+                    opt.rewrite != "window" && opt.rewrite != "async" && opt.rewrite != "auto") {
+                    std::fprintf(stderr, "Error: --rewrite must be gather, scatter, window, async or auto (got %s)\n", optarg);
+                    std::exit(1);
+                }
+                break;
+            case 'M':
+                try {
+                    opt.window_mb = std::stoull(optarg);
+                } catch (const std::exception&) {
+                    std::fprintf(stderr, "Error: --window not a number (%s)\n", optarg);
+                    std::exit(1);
+                }
+                if (opt.window_mb == 0) {
+                    std::fprintf(stderr, "Error: --window must be > 0\n");
+                    std::exit(1);
+                }
+                break;
+            case 'O':
+                try {
+                    opt.direct = std::stoull(optarg);
+                } catch (const std::exception&) {
+                    std::fprintf(stderr, "Error: --direct not a number (%s)\n", optarg);
+                    std::exit(1);
+                }
+                break;
+            case 'Y':
+                opt.key    = optarg;
+                g_key_spec = parse_key_spec(opt.key);
+                break;
             case 'h':
             default:
                 std::fprintf(stderr,
@@ -171,6 +498,32 @@ static inline Params parse_argv(int argc, char** argv)
                     "  -p, --payload B      maximum payload size in bytes (default 256)\n"
                     "  -t, --threads T      threads to use (0 = hw concurrency)\n"
                     "  -c, --cutoff  N      task cutoff size    (default 10000)\n"
+                    "  -m, --merge   S      MPI merge: pairwise | shm | rma | kway | multiway\n"
+                    "                       (default pairwise)\n"
+                    "  -z, --compress       delta/varint-encode IndexRec streams between ranks;\n"
+                    "                       pipeline drivers: block-compress the run file\n"
+                    "      --chunk   C      MPI: deal the index in C-record chunks (0 = one-shot)\n"
+                    "      --checkpoint DIR MPI: persist phases under DIR and resume from them\n"
+                    "  -s, --sample         split work by sampled key ranges (no global merge)\n"
+                    "      --run     R      pipeline drivers: records per sorted run\n"
+                    "                       (default max(-c, N / (4 x sorter threads)))\n"
+                    "      --dag            OpenMP: spawn the mergesort tree flat as a depend() DAG\n"
+                    "      --autotune       probe the data, choose -c, -t and --run (overrides them),\n"
+                    "                       cache the choice in files/tune_*.cfg\n"
+                    "      --format  F      generated input format: v1 (raw, default) | v2 (header,\n"
+                    "                       8-byte aligned records, offset table); outputs follow input\n"
+                    "      --rewrite S      output pass: gather (random read, default) | scatter\n"
+                    "                       (sequential read, random write) | window (offset-sorted\n"
+                    "                       batched reads) | async (pwrite writer overlapped with\n"
+                    "                       the gather) | auto (scatter when input + output\n"
+                    "                       exceed available memory or the input is not\n"
+                    "                       cached)\n"
+                    "      --window  MB     staging memory of --rewrite window (default 64)\n"
+                    "      --direct  D      index scan with O_DIRECT reads, D blocks read ahead\n"
+                    "                       (0 = mmap, default); keeps the input out of the page cache\n"
+                    "      --key     SPEC   sort order: asc | desc, then secondary payload fields\n"
+                    "                       OFF:LEN[:asc|desc] (e.g. desc,0:4); fields need a build\n"
+                    "                       with SORT_KEY_BITS wider than KEY_BITS\n"
                     "  -h, --help           show this help\n", argv[0]);
                 std::exit(c == 'h' ? 0 : 1);
         }
@@ -183,14 +536,14 @@ static inline Params parse_argv(int argc, char** argv)
 static inline void sort_records(IndexRec* base, std::size_t n)
 {
     std::sort(base, base + n,
-            [](const IndexRec& a, const IndexRec& b) { return a.key < b.key; });
+            [](const IndexRec& a, const IndexRec& b) { return key_less(a.key, b.key); });
 }
 
 
 static inline void dump_records(const Record* base, std::size_t n, std::size_t max_lines = 10)
 {
     for (std::size_t i = 0; i < n && i < max_lines; ++i)
-        std::printf("%4zu : key=%lu  len=%u\n", i, base[i].key, base[i].len);
+        std::printf("%4zu : key=%s  len=%u\n", i, key_str(base[i].key).c_str(), base[i].len);
     if (n > max_lines) std::puts("…");
 }
 
@@ -201,29 +554,419 @@ static inline void merge_records(IndexRec* base, std::size_t left, std::size_t m
     std::inplace_merge(base + left,           // first half begin
                        base + mid + 1,        // second half begin
                        base + right + 1,      // range end (one-past-last)
-                       [](const IndexRec& a, const IndexRec& b) { return a.key < b.key; });
+                       [](const IndexRec& a, const IndexRec& b) { return key_less(a.key, b.key); });
+}
+
+
+// K-way merge of sorted runs
+// A loser (tournament) tree over k sources: node[0] holds the current winner,
+// node[1..k-1] the loser of each match; leaves are the implicit slots k..2k-1,
+// so any k works. Exhausted sources compare as +infinity.
+struct RunView {
+    const IndexRec* data;
+    std::size_t     n;
+};
+
+struct LoserTree {
+    int                        k = 0;
+    std::vector<int>           node;
+    std::vector<sort_key_t>    head;    // current key of each source
+    std::vector<char>          done;    // source exhausted
+
+    bool beats(int a, int b) const {
+        if (done[a]) return false;
+        if (done[b]) return true;
+        return key_less(head[a], head[b]) || (!key_less(head[b], head[a]) && a < b);
+    }
+
+    int build_rec(int n) {
+        if (n >= k) return n - k;
+        const int l = build_rec(2 * n), r = build_rec(2 * n + 1);
+        if (beats(l, r)) { node[n] = r; return l; }
+        node[n] = l; return r;
+    }
+
+    // Heads and done flags must be set before calling
+    void build() {
+        node.assign(std::max(k, 1), 0);
+        node[0] = (k == 1) ? 0 : build_rec(1);
+    }
+
+    // Source `src` (the last winner) changed its head: replay its path to the root
+    void replay(int src) {
+        int w = src;
+        for (int n = (src + k) / 2; n >= 1; n /= 2)
+            if (beats(node[n], w)) std::swap(node[n], w);
+        node[0] = w;
+    }
+
+    int winner() const { return node[0]; }
+};
+
+// Serial k-way merge of `runs` into `out` (out must hold the sum of the run sizes)
+static inline void merge_runs_kway(const std::vector<RunView>& runs, IndexRec* out)
+{
+    const int k = static_cast<int>(runs.size());
+    if (k == 0) return;
+    std::vector<std::size_t> pos(k, 0);
+    LoserTree lt;
+    lt.k = k;
+    lt.head.resize(k);
+    lt.done.resize(k);
+    for (int r = 0; r < k; ++r) {
+        lt.done[r] = (runs[r].n == 0);
+        if (!lt.done[r]) lt.head[r] = runs[r].data[0].key;
+    }
+    lt.build();
+
+    std::size_t o = 0;
+    for (int w = lt.winner(); !lt.done[w]; w = lt.winner()) {
+        out[o++] = runs[w].data[pos[w]];
+        if (++pos[w] == runs[w].n) lt.done[w] = 1;
+        else                      lt.head[w] = runs[w].data[pos[w]].key;
+        lt.replay(w);
+    }
+}
+
+// Cut k sorted runs into `parts` independent key ranges for a parallel merge.
+// Splitter keys are quantiles of a regular sample of every run; cuts[p][r] is
+// where part p starts in run r (cuts[parts][r] == runs[r].n).
+static inline std::vector< std::vector<std::size_t> >
+split_runs_by_key(const std::vector<RunView>& runs, int parts)
+{
+    const int k = static_cast<int>(runs.size());
+    std::vector<sort_key_t> sample;
+    const std::size_t per_run = 64 * static_cast<std::size_t>(parts);
+    for (const auto& r : runs)
+        for (std::size_t i = 0; i < per_run && r.n > 0; ++i)
+            sample.push_back(r.data[(r.n * i) / per_run].key);
+    std::sort(sample.begin(), sample.end(), key_less);
+
+    std::vector< std::vector<std::size_t> > cuts(parts + 1, std::vector<std::size_t>(k, 0));
+    for (int r = 0; r < k; ++r) cuts[parts][r] = runs[r].n;
+    for (int p = 1; p < parts; ++p) {
+        const sort_key_t splitter = sample.empty() ? sort_key_t{0} : sample[(sample.size() * p) / parts];
+        for (int r = 0; r < k; ++r) {
+            const IndexRec* b = runs[r].data;
+            cuts[p][r] = std::lower_bound(b, b + runs[r].n, splitter,
+                             [](const IndexRec& a, sort_key_t key) { return key_less(a.key, key); }) - b;
+        }
+    }
+    return cuts;
+}
+
+
+// Key-range partitioning (sample sort)
+// parts-1 splitters are quantiles of a random sample of `oversample` keys per
+// part. A record with key k belongs to bucket upper_bound(splitters, k), so the
+// buckets cover disjoint key ranges and, once each one is sorted on its own,
+// their concatenation is the global order.
+static inline std::vector<sort_key_t>
+pick_splitters(const IndexRec* idx, std::size_t n, int parts, std::size_t oversample = 64)
+{
+    std::vector<sort_key_t> splitters;
+    if (parts <= 1 || n == 0) return splitters;
+    std::mt19937_64 rng(0x5eed5eedULL);
+    std::uniform_int_distribution<std::size_t> pick(0, n - 1);
+    std::vector<sort_key_t> sample(oversample * parts);
+    for (auto& k : sample) k = idx[pick(rng)].key;
+    std::sort(sample.begin(), sample.end(), key_less);
+    for (int p = 1; p < parts; ++p) splitters.push_back(sample[(sample.size() * p) / parts]);
+    return splitters;
+}
+
+static inline int key_bucket(const std::vector<sort_key_t>& splitters, sort_key_t key)
+{
+    return static_cast<int>(std::upper_bound(splitters.begin(), splitters.end(), key, key_less)
+                            - splitters.begin());
+}
+
+#ifdef _OPENMP
+// Scatter src[0, n) into dst grouped by bucket (splitters.size()+1 buckets),
+// keeping scan order inside a bucket. Each thread histograms a contiguous
+// stripe, an exclusive prefix sum (bucket-major, then thread) gives every
+// thread its write cursor in every bucket, and the stripes are scattered with
+// no further synchronisation. Returns the bucket starts (size buckets+1).
+static inline std::vector<std::size_t>
+partition_by_key(const IndexRec* src, std::size_t n,
+                 const std::vector<sort_key_t>& splitters, IndexRec* dst)
+{
+    const int B = static_cast<int>(splitters.size()) + 1;
+    const int T = omp_get_max_threads();
+    std::vector<std::size_t> cursor(static_cast<std::size_t>(T) * B, 0);   // [t*B + b]
+    std::vector<std::size_t> starts(B + 1, 0);
+
+    #pragma omp parallel num_threads(T)
+    {
+        const int t  = omp_get_thread_num();
+        const int nt = omp_get_num_threads();
+        const std::size_t from = n * t / nt, to = n * (t + 1) / nt;
+        std::size_t* mine = &cursor[static_cast<std::size_t>(t) * B];
+
+        for (std::size_t i = from; i < to; ++i) ++mine[key_bucket(splitters, src[i].key)];
+
+        #pragma omp barrier
+        #pragma omp single
+        {
+            std::size_t sum = 0;
+            for (int b = 0; b < B; ++b) {
+                starts[b] = sum;
+                for (int u = 0; u < nt; ++u) {
+                    const std::size_t c = cursor[static_cast<std::size_t>(u) * B + b];
+                    cursor[static_cast<std::size_t>(u) * B + b] = sum;
+                    sum += c;
+                }
+            }
+            starts[B] = sum;
+        }
+
+        for (std::size_t i = from; i < to; ++i) dst[mine[key_bucket(splitters, src[i].key)]++] = src[i];
+    }
+    return starts;
+}
+
+// Mergesort as a task DAG (--dag)
+// Same halving as the recursive mergesort_task of the drivers, but the whole
+// tree is spawned flat by the calling thread: a leaf task has depend(out) on
+// its node sentinel, a merge task depend(in) on both children and depend(out)
+// on its own. Nothing waits at internal nodes, so a merge becomes ready as soon
+// as its two inputs are sorted. With a gate, leaves first wait for their slice;
+// the caller must then run mergesort_dag itself as a task, because a runtime
+// with a long task queue may execute leaves inline on the spawning thread.
+static inline void mergesort_dag_node(IndexRec* base, std::size_t left, std::size_t right,
+                                      std::size_t cutoff, ProgressGate* gate,
+                                      char* dep, std::size_t node)
+{
+    if (right - left > cutoff) {
+        const std::size_t mid = (left + right) / 2;
+        mergesort_dag_node(base, left,    mid,   cutoff, gate, dep, 2 * node);
+        mergesort_dag_node(base, mid + 1, right, cutoff, gate, dep, 2 * node + 1);
+
+        #pragma omp task firstprivate(base, left, mid, right) \
+                         depend(in: dep[2 * node], dep[2 * node + 1]) depend(out: dep[node])
+        merge_records(base, left, mid, right);
+    } else {
+        #pragma omp task firstprivate(base, left, right, gate) depend(out: dep[node])
+        {
+            if (gate) gate->wait_until(right + 1);
+            sort_records(base + left, right - left + 1);
+        }
+    }
+}
+
+static inline void mergesort_dag(IndexRec* base, std::size_t n, std::size_t cutoff,
+                                 ProgressGate* gate = nullptr)
+{
+    if (n == 0) return;
+    std::size_t levels = 1;
+    for (std::size_t span = n; span - 1 > cutoff; span = (span + 1) / 2) ++levels;
+    std::vector<char> dep(std::size_t{1} << levels, 0);   // heap-numbered node sentinels
+    mergesort_dag_node(base, 0, n - 1, cutoff, gate, dep.data(), 1);
+    #pragma omp taskwait
+}
+#endif
+
+
+// IndexRec wire codec
+// Compact encoding of IndexRec runs for transfers between ranks. A run is cut
+// into self-contained blocks of at most CODEC_BLOCK records so the receiver
+// can decode block k while block k+1 is still in flight.
+// Block layout:
+//   u8 flags | varint n | varint base_off | n x ( varint key | varint len | off )
+// - CODEC_KEY_DELTA: keys are non-decreasing, each one stored as the gap from the previous
+// - CODEC_OFF_SCAN : offsets are contiguous in file order (one-shot slices), so only the first is stored
+// otherwise off is a varint relative to the smallest offset of the block.
+// Inline entries (len <= INLINE_PAYLOAD) always store off as 8 raw payload bytes;
+// in scan blocks they still advance the running offset by their record size.
+constexpr std::size_t  CODEC_BLOCK     = 1 << 16;   // records per block
+constexpr std::uint8_t CODEC_KEY_DELTA = 1u << 0;
+constexpr std::uint8_t CODEC_OFF_SCAN  = 1u << 1;
+
+// Templated on the value type so 128-bit keys encode like the rest
+template <class U>
+static inline void put_varint(std::vector<std::uint8_t>& out, U v)
+{
+    while (v >= 0x80) { out.push_back(static_cast<std::uint8_t>(v | 0x80)); v >>= 7; }
+    out.push_back(static_cast<std::uint8_t>(v));
+}
+
+template <class U = std::uint64_t>
+static inline U get_varint(const std::uint8_t*& p)
+{
+    U v = 0;
+    for (int shift = 0; ; shift += 7) {
+        const std::uint8_t b = *p++;
+        v |= static_cast<U>(b & 0x7f) << shift;
+        if (!(b & 0x80)) return v;
+    }
+}
+
+// Append one encoded block of `n` records to `out`
+static inline void encode_index_block(const IndexRec* r, std::size_t n, std::vector<std::uint8_t>& out)
+{
+    constexpr std::uint64_t HDR = REC_HDR;
+
+    // Scan check: every stored offset must equal base + bytes of the records before it
+    std::uint8_t  flags    = CODEC_KEY_DELTA | CODEC_OFF_SCAN;
+    std::uint64_t min_off  = ~0ULL;
+    std::uint64_t scan_off = 0;     // base of the scan, taken from the first stored offset
+    std::uint64_t rel      = 0;     // bytes of the records before i
+    bool          based    = false;
+    for (std::size_t i = 0; i < n; ++i) {
+        if (i > 0 && key_less(r[i].key, r[i - 1].key)) flags &= ~CODEC_KEY_DELTA;
+        if (!is_inline(r[i])) {
+            if (!based) { scan_off = r[i].offset - rel; based = true; }
+            else if (r[i].offset != scan_off + rel) flags &= ~CODEC_OFF_SCAN;
+            min_off = std::min<std::uint64_t>(min_off, r[i].offset);
+        }
+        rel += HDR + r[i].len;
+    }
+    if (!based) min_off = 0;
+
+    out.push_back(flags);
+    put_varint(out, n);
+    put_varint(out, (flags & CODEC_OFF_SCAN) ? scan_off : min_off);
+
+    sort_key_t prev_key = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        put_varint(out, (flags & CODEC_KEY_DELTA) ? sort_key_t(r[i].key - prev_key) : r[i].key);
+        prev_key = r[i].key;
+        put_varint(out, r[i].len);
+        if (is_inline(r[i])) {
+            const std::uint8_t* raw = reinterpret_cast<const std::uint8_t*>(&r[i].offset);
+            out.insert(out.end(), raw, raw + sizeof(r[i].offset));
+        } else if (!(flags & CODEC_OFF_SCAN)) {
+            put_varint(out, r[i].offset - min_off);
+        }
+    }
+}
+
+// Decode one block into `dst`; returns the number of records written
+static inline std::size_t decode_index_block(const std::uint8_t* p, IndexRec* dst)
+{
+    constexpr std::uint64_t HDR = REC_HDR;
+
+    const std::uint8_t  flags = *p++;
+    const std::size_t   n     = get_varint(p);
+    const std::uint64_t base  = get_varint(p);
+
+    sort_key_t    key = 0;
+    std::uint64_t rel = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        const sort_key_t k = get_varint<sort_key_t>(p);
+        key = (flags & CODEC_KEY_DELTA) ? sort_key_t(key + k) : k;
+        const uint32_t len = static_cast<uint32_t>(get_varint(p));
+        IndexRec rec{ key, len, 0 };
+        if (is_inline(rec)) {
+            std::memcpy(&rec.offset, p, sizeof(rec.offset));
+            p += sizeof(rec.offset);
+        } else {
+            rec.offset = (flags & CODEC_OFF_SCAN) ? base + rel : base + get_varint(p);
+        }
+        dst[i] = rec;
+        rel += HDR + len;
+    }
+    return n;
+}
+
+
+// File format v2 (--format v2)
+// v1 is the raw concatenation of {key, len, payload} (8B + 4B by default). v2 starts with a
+// 64-byte header and pads every record to a multiple of 8 bytes, so every key
+// is 8-byte aligned and the file states its own record count:
+//   FileHeaderV2 | records, 8-aligned | [offset table: N x u64 record offsets]
+// Readers recognise v2 by its magic, so v1 files stay readable everywhere.
+// Sorted outputs keep the format of their input and set V2_SORTED.
+constexpr char          V2_MAGIC[8] = {'R', 'E', 'C', 'S', 'O', 'R', 'T', '2'};
+constexpr std::uint32_t V2_SORTED   = 1u << 0;
+constexpr std::uint64_t V2_ALIGN    = 8;
+
+struct FileHeaderV2 {
+    char          magic[8];
+    std::uint32_t version;       // 2
+    std::uint32_t flags;         // V2_SORTED
+    std::uint64_t n_records;
+    std::uint64_t total_bytes;   // whole file
+    std::uint64_t data_off;      // first record
+    std::uint64_t offsets_at;    // offset table, 0 = none
+    std::uint64_t reserved[2];
+};
+static_assert(sizeof(FileHeaderV2) == 64, "FileHeaderV2 must stay 64 bytes");
+
+// Where the records of a mapped file start and how they are padded
+struct RecLayout {
+    std::uint64_t data_off   = 0;
+    std::uint64_t align      = 1;
+    std::uint64_t n          = 0;     // header count (v2), 0 = unknown
+    std::uint64_t offsets_at = 0;
+    std::uint64_t total      = 0;     // file size from the header (v2)
+    std::uint32_t flags      = 0;
+    bool          v2         = false;
+};
+
+static inline RecLayout record_layout(const void* map, std::size_t file_sz)
+{
+    RecLayout lay;
+    FileHeaderV2 h;
+    if (file_sz < sizeof h) return lay;
+    std::memcpy(&h, map, sizeof h);
+    if (std::memcmp(h.magic, V2_MAGIC, sizeof h.magic) != 0 || h.version != 2) return lay;
+    lay.data_off   = h.data_off;
+    lay.align      = V2_ALIGN;
+    lay.n          = h.n_records;
+    lay.offsets_at = h.offsets_at;
+    lay.total      = h.total_bytes;
+    lay.flags      = h.flags;
+    lay.v2         = true;
+    return lay;
+}
+
+// Bytes one record occupies in the file (header + payload + padding)
+static inline std::uint64_t rec_span(std::uint32_t len, const RecLayout& lay)
+{
+    const std::uint64_t sz = REC_HDR + len;
+    return (sz + lay.align - 1) / lay.align * lay.align;
+}
+
+static inline FileHeaderV2 make_header_v2(std::uint64_t n, std::uint64_t total_bytes,
+                                          std::uint64_t offsets_at, bool sorted)
+{
+    FileHeaderV2 h{};
+    std::memcpy(h.magic, V2_MAGIC, sizeof h.magic);
+    h.version     = 2;
+    h.flags       = sorted ? V2_SORTED : 0;
+    h.n_records   = n;
+    h.total_bytes = total_bytes;
+    h.data_off    = sizeof(FileHeaderV2);
+    h.offsets_at  = offsets_at;
+    return h;
+}
+
+
+// Name of the generated input for (n, payload_max, format)
+static inline std::string unsorted_file_path(std::size_t total_n, std::uint32_t payload_max, int format = 1)
+{
+    return "files/unsorted_" + std::to_string(total_n) + "_" + std::to_string(payload_max)
+         + (format == 2 ? "_v2" : "") + schema_tag() + ".bin";
 }
 
 
 // mmap generator with exact-size preallocation and single-recopy
+// format 2 writes a v2 file (header, aligned records, offset table) under a _v2 name
 static std::string generate_unsorted_file_mmap(std::size_t total_n,
-                                               std::uint32_t payload_max)
+                                               std::uint32_t payload_max,
+                                               int format = 1)
 {
     namespace fs = std::filesystem;
     fs::create_directories("files");
 
-    std::string path = "files/unsorted_"
-                     + std::to_string(total_n) + "_"
-                     + std::to_string(payload_max) + ".bin";
+    std::string path = unsorted_file_path(total_n, payload_max, format);
 
     if (fs::exists(path)) {
         std::cout << "Skipping gen; found “" << path << "”.\n";
         return path;
     }
 
-    constexpr std::size_t KEY_SZ = sizeof(unsigned long);
-    constexpr std::size_t LEN_SZ = sizeof(uint32_t);
-
     // RNG setup
     std::mt19937                    rng{42};
     std::uniform_int_distribution<> key_gen(0, INT32_MAX);
@@ -232,14 +975,18 @@ static std::string generate_unsorted_file_mmap(std::size_t total_n,
 
     // 1) Precompute keys & lengths so we know exact file size
     //BENCH_START(generate_arrays);
-    std::vector<unsigned long> keys (total_n);
+    std::vector<rec_key_t>     keys (total_n);
     std::vector<uint32_t>      lens (total_n);
-    std::size_t exact_size = 0;
+    RecLayout lay;
+    if (format == 2) { lay.v2 = true; lay.align = V2_ALIGN; lay.data_off = sizeof(FileHeaderV2); }
+    std::size_t exact_size = lay.data_off;
     for (std::size_t i = 0; i < total_n; ++i) {
-        keys[i] = static_cast<unsigned long>( key_gen(rng) );
+        keys[i] = static_cast<rec_key_t>    ( key_gen(rng) );
         lens[i] = static_cast<uint32_t>      ( len_gen(rng) );
-        exact_size += KEY_SZ + LEN_SZ + lens[i];
+        exact_size += rec_span(lens[i], lay);
     }
+    const std::size_t offsets_at = lay.v2 ? exact_size : 0;
+    if (lay.v2) exact_size += total_n * sizeof(std::uint64_t);
     //BENCH_STOP(generate_arrays);
 
     // 2) open & preallocate exactly exact_size bytes
@@ -268,26 +1015,30 @@ static std::string generate_unsorted_file_mmap(std::size_t total_n,
 
     // 4) prepare a single-record buffer: header + max-payload
     //BENCH_START(generate_records);
-    std::vector<char> record_buf(KEY_SZ + LEN_SZ + payload_max);
-    std::size_t offset = 0;
+    std::vector<char> record_buf(REC_HDR + payload_max);
+    std::size_t offset = lay.data_off;
 
     for (std::size_t i = 0; i < total_n; ++i) {
-        unsigned long key = keys[i];
-        uint32_t      len = lens[i];
+        rec_key_t key = keys[i];
+        uint32_t  len = lens[i];
 
         // fill header into record_buf
-        std::memcpy(record_buf.data(), &key, KEY_SZ);
-        std::memcpy(record_buf.data() + KEY_SZ, &len, LEN_SZ);
+        RecSchema::put_header(record_buf.data(), key, len);
 
         // fill payload bytes
         for (uint32_t j = 0; j < len; ++j) {
-            record_buf[KEY_SZ + LEN_SZ + j] = static_cast<char>(byte_gen(rng));
+            record_buf[REC_HDR + j] = static_cast<char>(byte_gen(rng));
         }
 
         // one bulk copy into the mmap’d file
-        std::size_t rec_sz = KEY_SZ + LEN_SZ + len;
+        std::size_t rec_sz = REC_HDR + len;
         std::memcpy(map + offset, record_buf.data(), rec_sz);
-        offset += rec_sz;
+        if (lay.v2) std::memcpy(map + offsets_at + i * sizeof(std::uint64_t), &offset, sizeof(std::uint64_t));
+        offset += rec_span(len, lay);   // v2 padding stays zero (ftruncate)
+    }
+    if (lay.v2) {
+        const FileHeaderV2 h = make_header_v2(total_n, exact_size, offsets_at, /*sorted=*/false);
+        std::memcpy(map, &h, sizeof h);
     }
     //BENCH_STOP(generate_records);
 
@@ -302,14 +1053,150 @@ static std::string generate_unsorted_file_mmap(std::size_t total_n,
 }
 
 
+// O_DIRECT index scan (--direct D)
+// The mmap scan relies on kernel readahead and leaves the whole input in the
+// page cache, crowding out the pages the random rewrite gather needs later.
+// This scan reads DIRECT_BLOCK-sized aligned blocks with O_DIRECT, keeping
+// `depth` of them in flight on async readers while the current one is parsed.
+// A record whose header (or inline payload) straddles two blocks is finished
+// from a small carry buffer. Without O_DIRECT support (e.g. tmpfs) the blocks
+// are read buffered and dropped from the cache with POSIX_FADV_DONTNEED.
+// scan_records_direct hands each record to `take(i, rec)` in file order, so
+// the MPI root scanners can deal records out while they read.
+constexpr std::size_t DIRECT_BLOCK = 4u << 20;
+constexpr std::size_t IO_ALIGN     = 4096;       // O_DIRECT buffer / offset alignment
+
+template <class Take>
+static inline void scan_records_direct(const std::string& path, std::size_t n, std::size_t depth, Take&& take)
+{
+  bool direct = true;
+  int fd = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+  if (fd < 0 && errno == EINVAL) { direct = false; fd = ::open(path.c_str(), O_RDONLY); }
+  if (fd < 0) { std::perror("open"); std::exit(1); }
+  struct stat st{};
+  if (fstat(fd, &st) < 0) { std::perror("fstat"); std::exit(1); }
+  const std::uint64_t file_sz  = static_cast<std::uint64_t>(st.st_size);
+  const std::size_t   n_blocks = (file_sz + DIRECT_BLOCK - 1) / DIRECT_BLOCK;
+  depth = std::max<std::size_t>(1, depth);
+
+  std::vector<char*>             buf(depth);
+  std::vector<std::future<long>> got(depth);
+  for (auto& b : buf)
+    if (!(b = static_cast<char*>(std::aligned_alloc(IO_ALIGN, DIRECT_BLOCK)))) { std::perror("aligned_alloc"); std::exit(1); }
+  auto issue = [&](std::size_t k) {
+    got[k % depth] = std::async(std::launch::async, [fd, b = buf[k % depth], at = k * DIRECT_BLOCK, direct] {
+      long done = 0;
+      while (done < static_cast<long>(DIRECT_BLOCK)) {
+        const ssize_t rd = ::pread(fd, b + done, DIRECT_BLOCK - done, static_cast<off_t>(at + done));
+        if (rd < 0) { std::perror("pread"); std::exit(1); }
+        if (rd == 0) break;   // EOF
+        done += rd;
+      }
+      if (!direct) posix_fadvise(fd, static_cast<off_t>(at), DIRECT_BLOCK, POSIX_FADV_DONTNEED);
+      return done;
+    });
+  };
+  for (std::size_t k = 0; k < std::min(depth, n_blocks); ++k) issue(k);
+
+  // make_index_rec reads the header plus up to `head` payload bytes (inline
+  // payload, --key fields); a record is only decoded once those are at hand
+  constexpr std::size_t HDR  = REC_HDR;
+  const std::uint32_t   head = std::max<std::uint32_t>(INLINE_PAYLOAD, key_fields_end());
+  std::vector<char>     carry(HDR + head);       // head of a record cut by a block end
+  std::size_t           carried = 0;
+  RecLayout     lay;
+  std::uint64_t pos = 0;                       // next record start (file offset)
+  std::size_t   i   = 0;
+
+  for (std::size_t k = 0; k < n_blocks && i < n; ++k) {
+    const long          len   = got[k % depth].get();
+    const char*         b     = buf[k % depth];
+    const std::uint64_t begin = k * DIRECT_BLOCK;
+    const std::uint64_t end   = begin + static_cast<std::uint64_t>(len);
+    if (k == 0) {
+      lay = record_layout(b, static_cast<std::size_t>(len));
+      if (lay.v2 && lay.n != n) {
+        std::fprintf(stderr, "%s holds %lu records, %zu expected\n", path.c_str(),
+                     static_cast<unsigned long>(lay.n), n);
+        std::exit(1);
+      }
+      pos = lay.data_off;
+    }
+
+    // finish the record cut at the previous block end (its head may span blocks)
+    if (carried) {
+      std::size_t used = 0;
+      auto fill = [&](std::size_t want) {
+        const std::size_t more = std::min<std::size_t>(want - std::min(want, carried),
+                                                       static_cast<std::size_t>(len) - used);
+        std::memcpy(carry.data() + carried, b + used, more);
+        carried += more;
+        used    += more;
+      };
+      fill(HDR);
+      const std::size_t need = carried < HDR ? HDR
+                             : HDR + std::min<std::uint32_t>(RecSchema::len_at(carry.data()), head);
+      fill(need);
+      if (carried < need) {                     // the whole block belongs to this record's head
+        if (k + depth < n_blocks) issue(k + depth);
+        continue;
+      }
+      const IndexRec rec = make_index_rec(carry.data(), pos);
+      pos += rec_span(rec.len, lay);
+      carried = 0;
+      take(i++, rec);
+    }
+
+    // whole records of this block; a payload may run on into later blocks
+    while (i < n && pos < end) {
+      const char* rec = b + (pos - begin);
+      if (pos + HDR > end) break;
+      const uint32_t rec_len = RecSchema::len_at(rec);
+      if (pos + HDR + std::min(rec_len, head) > end) break;
+      take(i++, make_index_rec(rec, pos));
+      pos += rec_span(rec_len, lay);
+    }
+    if (i < n && pos < end) {
+      carried = static_cast<std::size_t>(end - pos);
+      std::memcpy(carry.data(), b + (pos - begin), carried);
+    }
+    if (k + depth < n_blocks) issue(k + depth);
+  }
+  for (auto& f : got) if (f.valid()) f.get();
+  for (auto* b : buf) std::free(b);
+
+  if (i != n) {
+    std::fprintf(stderr, "%s: unexpected EOF at record %zu\n", path.c_str(), i);
+    std::exit(1);
+  }
+  ::close(fd);
+}
+
+static inline void build_index_direct(const std::string& path, IndexRec* idx, std::size_t n,
+                                      std::size_t depth, int notify_every, ProgressGate* gate)
+{
+  scan_records_direct(path, n, depth, [&](std::size_t i, const IndexRec& rec) {
+    idx[i] = rec;
+    if (gate && notify_every > 0 && (i + 1) % static_cast<std::size_t>(notify_every) == 0) gate->notify(i + 1);
+  });
+  if (gate) gate->notify(n);
+}
+
+
 // Returns a malloc’d IndexRec[total_n], or nullptr on error.
 inline void build_index_mmap(const std::string& path,   // path to the unsorted file
                              IndexRec* idx,
                              std::size_t n,             // expected number of records
                              int notify_every = 0,
-                             ProgressGate* gate = nullptr)
+                             ProgressGate* gate = nullptr,
+                             std::size_t direct = 0)    // --direct: O_DIRECT scan depth
 {
   BENCH_START(reading);
+  if (direct > 0) {
+    build_index_direct(path, idx, n, direct, notify_every, gate);
+    BENCH_STOP(reading);
+    return;
+  }
   int fd = ::open(path.c_str(), O_RDONLY);
   if (fd < 0) { std::perror("open"); std::exit(1); }
   struct stat st{};
@@ -320,24 +1207,17 @@ inline void build_index_mmap(const std::string& path,   // path to the unsorted
   if (map == MAP_FAILED) { std::perror("mmap"); std::exit(1); }
 
   const unsigned char* base = static_cast<const unsigned char*>(map);
+  const RecLayout lay = record_layout(base, file_sz);
+  if (lay.v2 && lay.n != n) {
+    std::fprintf(stderr, "%s holds %lu records, %zu expected\n", path.c_str(),
+                 static_cast<unsigned long>(lay.n), n);
+    std::exit(1);
+  }
 
-  std::size_t pos = 0;
+  std::size_t pos = lay.data_off;
   for (std::size_t i = 0; i < n; ++i) {
-    const std::size_t rec_offset = pos;
-
-    unsigned long key;
-    std::memcpy(&key, base + pos, sizeof(unsigned long));
-    pos += sizeof(unsigned long);
-
-    uint32_t len;
-    std::memcpy(&len, base + pos, sizeof(uint32_t));
-    pos += sizeof(uint32_t);
-
-    idx[i].key    = key;
-    idx[i].offset = rec_offset;
-    idx[i].len    = len;
-
-    pos += len;
+    idx[i] = make_index_rec(reinterpret_cast<const char*>(base) + pos, pos);
+    pos += rec_span(idx[i].len, lay);
 
     if (gate && notify_every > 0) {
       const std::size_t filled_now = i + 1;
@@ -356,24 +1236,399 @@ inline void build_index_mmap(const std::string& path,   // path to the unsorted
 
 
 // ALLOCATING OVERLOAD (backward compatible with old seq code)
-inline IndexRec* build_index_mmap(const std::string& path, std::size_t n)
+inline IndexRec* build_index_mmap(const std::string& path, std::size_t n, std::size_t direct = 0)
 {
   // allocate with malloc because rewrite_sorted_mmap() calls free(idx)
   auto* idx = static_cast<IndexRec*>(std::malloc(n * sizeof(IndexRec)));
   if (!idx) { std::perror("malloc"); std::exit(1); }
 
   // delegate to the prealloc version with default behavior (no notifications)
-  build_index_mmap(path, idx, n, /*notify_every=*/0, /*gate=*/nullptr);
+  build_index_mmap(path, idx, n, /*notify_every=*/0, /*gate=*/nullptr, direct);
   return idx;
 }
 
 
+// Write idx (sorted) as a record file gathered from an input mapping.
+// The output keeps the input layout: v2 gets a header with V2_SORTED, padded
+// records and a fresh offset table.
+static inline bool write_sorted_records(const char*        in_map,     // mapped input
+                                        const RecLayout&   lay,        // its layout
+                                        const IndexRec*    idx,        // sorted index
+                                        std::size_t        n_idx,
+                                        const std::string& out_path)
+{
+    // total output size
+    std::size_t out_size = lay.data_off;
+    for (std::size_t i = 0; i < n_idx; ++i) out_size += rec_span(idx[i].len, lay);
+    const std::size_t offsets_at = lay.v2 ? out_size : 0;
+    if (lay.v2) out_size += n_idx * sizeof(std::uint64_t);
+
+    // open, truncate & mmap output read/write
+    int fd_out = ::open(out_path.c_str(), O_CREAT|O_RDWR|O_TRUNC, 0644);
+    if (fd_out < 0) { perror("open out"); return false; }
+    if (ftruncate(fd_out, out_size) < 0) { perror("ftruncate"); close(fd_out); return false; }
+    if (out_size == 0) { close(fd_out); return true; }
+
+    char* out_map = (char*)mmap(nullptr, out_size,
+                                PROT_WRITE, MAP_SHARED, fd_out, 0);
+    if (out_map == MAP_FAILED) { perror("mmap out"); close(fd_out); return false; }
+
+    // copy each record in one memcpy (inline entries straight from the index)
+    std::size_t out_off = lay.data_off;
+    for (std::size_t i = 0; i < n_idx; ++i) {
+        const IndexRec& r = idx[i];
+        put_record(out_map + out_off, r, in_map);
+        if (lay.v2) std::memcpy(out_map + offsets_at + i * sizeof(std::uint64_t), &out_off, sizeof(std::uint64_t));
+
+        out_off += rec_span(r.len, lay);
+    }
+    if (lay.v2) {
+        const FileHeaderV2 h = make_header_v2(n_idx, out_size, offsets_at, /*sorted=*/true);
+        std::memcpy(out_map, &h, sizeof h);
+    }
+
+    munmap(out_map, out_size);
+    close(fd_out);
+    return true;
+}
+
+
+constexpr std::size_t RUN_IO_BLOCK = 4u << 20;   // bytes per write()
+
+static inline void write_all(int fd, const char* p, std::size_t n, std::uint64_t at)
+{
+    while (n > 0) {
+        const ssize_t put = ::pwrite(fd, p, n, static_cast<off_t>(at));
+        if (put <= 0) { std::perror("pwrite"); std::exit(1); }
+        p += put; n -= put; at += put;
+    }
+}
+
+// Scatter rewrite (--rewrite scatter)
+// The gather above reads the input at random and writes the output in order.
+// The scatter turns it around: a prefix sum over the sorted sizes gives each
+// record its output offset, the (input, output) offset pairs are sorted by
+// input offset (the inverse permutation), and the input is then streamed in
+// file order while records are copied to their output slots. Each batch of
+// SCATTER_BATCH moves is ordered by destination first, so the random writes
+// of one batch land in rising page order in the write-back cache.
+constexpr std::size_t SCATTER_BATCH = 1 << 14;   // moves per destination-sorted batch
+
+struct ScatterMove {
+    std::uint64_t src;      // input offset
+    std::uint64_t dst;      // output offset
+    std::uint32_t bytes;    // header + payload
+};
+
+static inline bool scatter_sorted_records(const char*        in_map,
+                                          const RecLayout&   lay,
+                                          const IndexRec*    idx,
+                                          std::size_t        n_idx,
+                                          const std::string& out_path)
+{
+    std::size_t out_size = lay.data_off;
+    for (std::size_t i = 0; i < n_idx; ++i) out_size += rec_span(idx[i].len, lay);
+    const std::size_t offsets_at = lay.v2 ? out_size : 0;
+    if (lay.v2) out_size += n_idx * sizeof(std::uint64_t);
+
+    int fd_out = ::open(out_path.c_str(), O_CREAT|O_RDWR|O_TRUNC, 0644);
+    if (fd_out < 0) { perror("open out"); return false; }
+    if (ftruncate(fd_out, out_size) < 0) { perror("ftruncate"); close(fd_out); return false; }
+    if (out_size == 0) { close(fd_out); return true; }
+
+    char* out_map = (char*)mmap(nullptr, out_size,
+                                PROT_WRITE, MAP_SHARED, fd_out, 0);
+    if (out_map == MAP_FAILED) { perror("mmap out"); close(fd_out); return false; }
+
+    // 1) destinations in key order; inline entries need no input and go out now
+    std::vector<ScatterMove> moves;
+    moves.reserve(n_idx);
+    std::uint64_t dst = lay.data_off;
+    for (std::size_t i = 0; i < n_idx; ++i) {
+        const IndexRec& r = idx[i];
+        if (is_inline(r)) put_record(out_map + dst, r, in_map);
+        else moves.push_back(ScatterMove{ r.offset, dst,
+                                          static_cast<std::uint32_t>(REC_HDR + r.len) });
+        if (lay.v2) std::memcpy(out_map + offsets_at + i * sizeof(std::uint64_t), &dst, sizeof(std::uint64_t));
+        dst += rec_span(r.len, lay);
+    }
+
+    // 2) inverse permutation: moves in input order
+    std::sort(moves.begin(), moves.end(),
+              [](const ScatterMove& a, const ScatterMove& b) { return a.src < b.src; });
+
+    // 3) stream the input, scatter each batch in destination order
+    madvise(const_cast<char*>(in_map), dst, MADV_SEQUENTIAL);   // same layout: input data ends at dst too
+    madvise(out_map, out_size, MADV_RANDOM);
+    for (std::size_t from = 0; from < moves.size(); from += SCATTER_BATCH) {
+        const auto first = moves.begin() + from;
+        const auto last  = moves.begin() + std::min(moves.size(), from + SCATTER_BATCH);
+        std::sort(first, last,
+                  [](const ScatterMove& a, const ScatterMove& b) { return a.dst < b.dst; });
+        for (auto m = first; m != last; ++m)
+            std::memcpy(out_map + m->dst, in_map + m->src, m->bytes);
+    }
+
+    if (lay.v2) {
+        const FileHeaderV2 h = make_header_v2(n_idx, out_size, offsets_at, /*sorted=*/true);
+        std::memcpy(out_map, &h, sizeof h);
+    }
+
+    munmap(out_map, out_size);
+    close(fd_out);
+    return true;
+}
+
+// Windowed gather (--rewrite window)
+// For inputs larger than the page cache every gather memcpy can be a seek.
+// The sorted index is cut into windows whose records fill half the staging
+// budget; a window's input offsets are sorted and read with pread in that
+// order, and the staged records are then emitted in key order. Neighbours are
+// coalesced into one read when the hole between them is no larger than the
+// window's mean record (at most WINDOW_GAP) and the other half of the budget
+// still has room for it, so sparse windows of a large input read little more
+// than their records and staging never grows past the budget. Random reads
+// become a few sweeps per window, W records long, with W set by the budget.
+constexpr std::uint64_t WINDOW_GAP = 64u << 10;   // read through holes up to this size
+
+struct WindowRead {
+    std::uint64_t src;      // input offset
+    std::uint32_t bytes;    // header + payload
+    std::uint32_t slot;     // position in the window (key order)
+};
+
+static inline bool window_sorted_records(int                fd_in,
+                                         const RecLayout&   lay,
+                                         const IndexRec*    idx,
+                                         std::size_t        n_idx,
+                                         const std::string& out_path,
+                                         std::size_t        budget)      // staging bytes
+{
+    std::size_t out_size = lay.data_off;
+    for (std::size_t i = 0; i < n_idx; ++i) out_size += rec_span(idx[i].len, lay);
+    const std::size_t offsets_at = lay.v2 ? out_size : 0;
+    if (lay.v2) out_size += n_idx * sizeof(std::uint64_t);
+
+    int fd_out = ::open(out_path.c_str(), O_CREAT|O_RDWR|O_TRUNC, 0644);
+    if (fd_out < 0) { perror("open out"); return false; }
+    if (ftruncate(fd_out, out_size) < 0) { perror("ftruncate"); close(fd_out); return false; }
+    if (out_size == 0) { close(fd_out); return true; }
+
+    char* out_map = (char*)mmap(nullptr, out_size,
+                                PROT_WRITE, MAP_SHARED, fd_out, 0);
+    if (out_map == MAP_FAILED) { perror("mmap out"); close(fd_out); return false; }
+
+    std::vector<WindowRead>    reads;
+    std::vector<std::uint64_t> at;        // staging offset per window slot
+    std::vector<char>          staging;
+    std::uint64_t              dst = lay.data_off;
+    std::size_t                windows = 0;
+    std::uint64_t              read_bytes = 0;
+    budget = std::max<std::size_t>(budget, 2);
+
+    for (std::size_t i = 0; i < n_idx; ++windows) {
+        // 1) next window: as many records as fit half the budget (at least one)
+        std::size_t j = i, bytes = 0;
+        for (; j < n_idx; ++j) {
+            const std::size_t rec_sz = REC_HDR + idx[j].len;
+            if (j > i && bytes + rec_sz > budget / 2) break;
+            bytes += rec_sz;
+        }
+
+        // 2) its input records in offset order
+        reads.clear();
+        at.assign(j - i, 0);
+        for (std::size_t k = i; k < j; ++k)
+            if (!is_inline(idx[k]))
+                reads.push_back(WindowRead{ idx[k].offset,
+                                            static_cast<std::uint32_t>(REC_HDR + idx[k].len),
+                                            static_cast<std::uint32_t>(k - i) });
+        std::sort(reads.begin(), reads.end(),
+                  [](const WindowRead& a, const WindowRead& b) { return a.src < b.src; });
+
+        // 3) coalesced reads into the staging buffer: holes up to the mean
+        //    record, and only while the hole bytes fit the rest of the budget
+        std::uint64_t rec_bytes = 0;
+        for (const WindowRead& rd : reads) rec_bytes += rd.bytes;
+        const std::uint64_t gap   = reads.empty() ? 0 : std::min<std::uint64_t>(WINDOW_GAP, rec_bytes / reads.size());
+        std::uint64_t       slack = budget > rec_bytes ? budget - rec_bytes : 0;
+        std::size_t fill = 0;
+        for (std::size_t r = 0; r < reads.size(); ) {
+            const std::uint64_t start = reads[r].src;
+            std::uint64_t       end   = start + reads[r].bytes;
+            std::size_t         q     = r + 1;
+            for (; q < reads.size(); ++q) {
+                const std::uint64_t hole = reads[q].src > end ? reads[q].src - end : 0;
+                if (hole > gap || hole > slack) break;
+                slack -= hole;
+                end = std::max<std::uint64_t>(end, reads[q].src + reads[q].bytes);
+            }
+
+            if (staging.size() < fill + (end - start)) staging.resize(fill + (end - start));
+            for (std::uint64_t got = 0; got < end - start; ) {
+                const ssize_t rd = ::pread(fd_in, staging.data() + fill + got, end - start - got,
+                                           static_cast<off_t>(start + got));
+                if (rd <= 0) { perror("pread"); munmap(out_map, out_size); close(fd_out); return false; }
+                got += rd;
+            }
+            for (; r < q; ++r) at[reads[r].slot] = fill + (reads[r].src - start);
+            fill       += end - start;
+            read_bytes += end - start;
+        }
+
+        // 4) emit in key order
+        for (std::size_t k = i; k < j; ++k) {
+            const IndexRec& rec = idx[k];
+            if (is_inline(rec)) put_record(out_map + dst, rec, nullptr);
+            else std::memcpy(out_map + dst, staging.data() + at[k - i],
+                             REC_HDR + rec.len);
+            if (lay.v2) std::memcpy(out_map + offsets_at + k * sizeof(std::uint64_t), &dst, sizeof(std::uint64_t));
+            dst += rec_span(rec.len, lay);
+        }
+        i = j;
+    }
+    if (lay.v2) {
+        const FileHeaderV2 h = make_header_v2(n_idx, out_size, offsets_at, /*sorted=*/true);
+        std::memcpy(out_map, &h, sizeof h);
+    }
+    std::printf("[rewrite] %zu windows of up to %zu MiB, %.1f MiB read\n",
+                windows, budget >> 20, read_bytes / double(1 << 20));
+
+    munmap(out_map, out_size);
+    close(fd_out);
+    return true;
+}
+
+// Asynchronous writer (--rewrite async)
+// With the mmap gather the copying thread also takes the page faults and the
+// write-back of the output. Here the output is written with pwrite from
+// REWRITE_BUFFERS aligned buffers of REWRITE_BUF_BYTES: the gatherer threads
+// fill one buffer (OpenMP builds split it between threads) while a writer
+// drains the previous one, so the phase costs max(gather, write), not the sum.
+constexpr int         REWRITE_BUFFERS   = 2;
+constexpr std::size_t REWRITE_BUF_BYTES = 4 * RUN_IO_BLOCK;
+
+static inline bool async_sorted_records(const char*        in_map,
+                                        const RecLayout&   lay,
+                                        const IndexRec*    idx,
+                                        std::size_t        n_idx,
+                                        const std::string& out_path)
+{
+    std::size_t   out_size = lay.data_off;
+    std::uint64_t max_span = 0;
+    for (std::size_t i = 0; i < n_idx; ++i) {
+        out_size += rec_span(idx[i].len, lay);
+        max_span  = std::max(max_span, rec_span(idx[i].len, lay));
+    }
+    const std::size_t offsets_at = lay.v2 ? out_size : 0;
+    if (lay.v2) out_size += n_idx * sizeof(std::uint64_t);
+
+    int fd_out = ::open(out_path.c_str(), O_CREAT|O_RDWR|O_TRUNC, 0644);
+    if (fd_out < 0) { perror("open out"); return false; }
+    if (ftruncate(fd_out, out_size) < 0) { perror("ftruncate"); close(fd_out); return false; }
+
+    // a buffer always holds at least one record
+    const std::size_t buf_bytes = (std::max<std::size_t>(REWRITE_BUF_BYTES, max_span) + IO_ALIGN - 1)
+                                / IO_ALIGN * IO_ALIGN;
+    char* buf[REWRITE_BUFFERS];
+    for (auto& b : buf)
+        if (!(b = static_cast<char*>(std::aligned_alloc(IO_ALIGN, buf_bytes)))) { perror("aligned_alloc"); std::exit(1); }
+    std::future<void>          pending[REWRITE_BUFFERS];
+    std::vector<std::uint64_t> table(lay.v2 ? n_idx : 0);
+    std::vector<std::uint32_t> at;        // record offsets inside the buffer
+
+    std::uint64_t dst = lay.data_off;
+    int           cur = 0;
+    for (std::size_t i = 0; i < n_idx; ) {
+        // 1) records of the next buffer and their places in it
+        std::size_t j = i, fill = 0;
+        at.clear();
+        for (; j < n_idx && fill + rec_span(idx[j].len, lay) <= buf_bytes; ++j) {
+            at.push_back(static_cast<std::uint32_t>(fill));
+            if (lay.v2) table[j] = dst + fill;
+            fill += rec_span(idx[j].len, lay);
+        }
+
+        // 2) wait for the writer to release this buffer, then gather into it
+        if (pending[cur].valid()) pending[cur].get();
+        char* const b = buf[cur];
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(static) if (j - i > 4096)
+#endif
+        for (std::size_t k = i; k < j; ++k) {
+            const std::size_t sz = put_record(b + at[k - i], idx[k], in_map);
+            std::memset(b + at[k - i] + sz, 0, rec_span(idx[k].len, lay) - sz);   // v2 padding
+        }
+
+        // 3) hand it to the writer and move on to the other buffer
+        pending[cur] = std::async(std::launch::async,
+                                  [fd_out, b, fill, to = dst] { write_all(fd_out, b, fill, to); });
+        dst += fill;
+        cur  = (cur + 1) % REWRITE_BUFFERS;
+        i    = j;
+    }
+    for (auto& p : pending) if (p.valid()) p.get();
+    for (auto* b : buf) std::free(b);
+
+    if (lay.v2) {
+        write_all(fd_out, reinterpret_cast<const char*>(table.data()), table.size() * sizeof(std::uint64_t), offsets_at);
+        const FileHeaderV2 h = make_header_v2(n_idx, out_size, offsets_at, /*sorted=*/true);
+        write_all(fd_out, reinterpret_cast<const char*>(&h), sizeof h, 0);
+    }
+    close(fd_out);
+    return true;
+}
+
+// --rewrite auto: gather while its random reads stay in the page cache,
+// scatter when they would go to disk. Right after generation and the index
+// scan the input is always resident, so residency alone says little: what
+// decides is whether the input and the output (about the same size) fit in
+// the memory the kernel can give the page cache (MemAvailable). If they do not,
+// the gather would evict input pages it still needs while the output grows.
+// When they fit, the input must also be mostly resident (mincore()); it may
+// not be after --direct on a cold file.
+static inline std::size_t available_memory()
+{
+    if (FILE* f = std::fopen("/proc/meminfo", "r")) {
+        char line[128];
+        unsigned long kb = 0;
+        while (std::fgets(line, sizeof line, f))
+            if (std::sscanf(line, "MemAvailable: %lu kB", &kb) == 1) break;
+        std::fclose(f);
+        if (kb) return static_cast<std::size_t>(kb) << 10;
+    }
+    return static_cast<std::size_t>(sysconf(_SC_AVPHYS_PAGES)) * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+}
+
+static inline bool gather_fits_cache(const char* in_map, std::size_t in_size)
+{
+    const std::size_t avail = available_memory();
+    if (2 * in_size > avail) {
+        std::printf("[rewrite] input %.1f MiB, %.1f MiB available: scatter\n",
+                    in_size / double(1 << 20), avail / double(1 << 20));
+        return false;
+    }
+    const std::size_t page  = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const std::size_t pages = (in_size + page - 1) / page;
+    std::vector<unsigned char> vec(pages);
+    if (pages == 0 || mincore(const_cast<char*>(in_map), in_size, vec.data()) < 0) return true;
+    std::size_t resident = 0;
+    for (unsigned char v : vec) resident += (v & 1);
+    const bool gather = 2 * resident >= pages;
+    std::printf("[rewrite] input %.1f MiB (%.1f%% resident), %.1f MiB available: %s\n",
+                in_size / double(1 << 20), 100.0 * resident / pages, avail / double(1 << 20),
+                gather ? "gather" : "scatter");
+    return gather;
+}
+
 //  Rewrite sorted file: Returns true on success, false on any error.
-static bool
+static inline bool
 rewrite_sorted_mmap(const std::string& in_path,     // path to the unsorted input file
                     const std::string& out_path,    // path for the sorted output file
                     IndexRec*          idx,         // array of IndexRec entries (key, offset, len), already sorted by key
-                    std::size_t        n_idx)       // number of entries in idx[]
+                    std::size_t        n_idx,       // number of entries in idx[]
+                    const std::string& strategy = "gather",   // --rewrite
+                    std::size_t        window_mb = 64)        // --window
 {
     // 1) open & stat input
     int fd_in = ::open(in_path.c_str(), O_RDONLY);
@@ -387,54 +1642,605 @@ rewrite_sorted_mmap(const std::string& in_path,     // path to the unsorted inpu
                                PROT_READ, MAP_SHARED, fd_in, 0);
     if (in_map == MAP_FAILED) { perror("mmap in"); close(fd_in); return false; }
 
-    // 3) compute total output size
-    std::size_t out_size = 0;
-    for (std::size_t i = 0; i < n_idx; ++i) {
-        out_size += sizeof(idx[i].key)
-                  + sizeof(idx[i].len)
-                  + idx[i].len;
+    // 3) gather the records in index order, or scatter them in input order
+    //    (same format as the input)
+    const RecLayout lay = record_layout(in_map, in_size);
+    const bool scatter  = strategy == "scatter" ||
+                          (strategy == "auto" && !gather_fits_cache(in_map, in_size));
+    const bool ok = scatter                ? scatter_sorted_records(in_map, lay, idx, n_idx, out_path)
+                  : strategy == "window"   ? window_sorted_records(fd_in, lay, idx, n_idx, out_path, window_mb << 20)
+                  : strategy == "async"    ? async_sorted_records (in_map, lay, idx, n_idx, out_path)
+                  :                          write_sorted_records  (in_map, lay, idx, n_idx, out_path);
+
+    // 4) cleanup
+    munmap(in_map,  in_size);
+    close(fd_in);
+    free(idx);
+    return ok;
+}
+
+
+// Run files (pipeline drivers)
+// The index is read in runs of --run records; each run is sorted and its
+// records (header + payload, same layout as the input) are appended to a run
+// file while later runs are still being read and sorted. RunSeg locates one
+// sorted run inside the run file. The final k-way merge walks the run file and
+// streams into the output through a double buffer: one block is written by an
+// async writer while the merge fills the other.
+// Records per run: --run/--autotune if given, else enough runs to keep every
+// sorter busy across `slots` runs in flight, but never below the task cutoff
+static inline std::size_t pipeline_run_len(const Params& opt, std::size_t slots, std::size_t sorters)
+{
+    if (opt.run_len) return opt.run_len;
+    const std::size_t runs = slots * std::max<std::size_t>(1, sorters);
+    return std::max<std::size_t>({opt.cutoff, (opt.n_records + runs - 1) / runs, 1});
+}
+
+struct RunSeg {
+    std::uint64_t off;      // byte offset in the run file
+    std::uint64_t bytes;    // byte length of the run
+};
+
+// Decode the next `n` records at pos of the input mapping into idx
+// (start at lay.data_off; pos is left on the record after the last one)
+static inline void read_index_chunk(const char* in_map, std::uint64_t& pos, IndexRec* idx, std::size_t n,
+                                    const RecLayout& lay = RecLayout{})
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        idx[i] = make_index_rec(in_map + pos, pos);
+        pos += rec_span(idx[i].len, lay);
     }
+}
 
-    //BENCH_START(open_and_mmap_output);
-    // 4) open, truncate & mmap output read/write
-    int fd_out = ::open(out_path.c_str(),
-                        O_CREAT|O_RDWR|O_TRUNC, 0644);
-    if (fd_out < 0) { perror("open out"); munmap(in_map, in_size); close(fd_in); return false; }
-    if (ftruncate(fd_out, out_size) < 0) { perror("ftruncate"); munmap(in_map, in_size); close(fd_in); close(fd_out); return false; }
+// Run-file codec (-z in the pipeline drivers)
+// Each RUN_IO_BLOCK of a run is stored as one self-contained block:
+//   RunBlockHdr | n x ( varint key gap | varint len ) | payloads
+// Keys are sorted within a run, so the 12-byte headers shrink to a few bytes.
+// The concatenated payloads go through a small LZ77 codec (LZ4-style
+// sequences, 64 KiB window) and are stored raw when that does not pay off,
+// e.g. for random payloads. The merge decodes one block per run at a time.
+constexpr std::size_t LZ_MIN_MATCH = 4;
+constexpr int         LZ_HASH_BITS = 14;
+
+struct RunBlockHdr {
+    std::uint32_t n;            // records
+    std::uint32_t raw_bytes;    // decoded size (headers + payloads)
+    std::uint32_t hdr_bytes;    // encoded header section
+    std::uint32_t pay_bytes;    // stored payload section
+    std::uint32_t pay_lz;       // payload section is LZ-compressed
+};
 
-    char* out_map = (char*)mmap(nullptr, out_size,
-                                PROT_WRITE, MAP_SHARED, fd_out, 0);
-    if (out_map == MAP_FAILED) { perror("mmap out"); munmap(in_map, in_size); close(fd_in); close(fd_out); return false; }
+static inline void lz_put_len(std::vector<std::uint8_t>& out, std::size_t v)
+{
+    for (; v >= 255; v -= 255) out.push_back(255);
+    out.push_back(static_cast<std::uint8_t>(v));
+}
 
-    //BENCH_STOP(open_and_mmap_output);
+// One sequence: literals, then (unless last) a match of mlen >= LZ_MIN_MATCH at distance off
+static inline void lz_put_seq(std::vector<std::uint8_t>& out, const char* lit, std::size_t n_lit,
+                              std::size_t off, std::size_t mlen)
+{
+    const std::size_t m = mlen ? mlen - LZ_MIN_MATCH : 0;
+    out.push_back(static_cast<std::uint8_t>((std::min<std::size_t>(n_lit, 15) << 4) | std::min<std::size_t>(m, 15)));
+    if (n_lit >= 15) lz_put_len(out, n_lit - 15);
+    out.insert(out.end(), lit, lit + n_lit);
+    if (!mlen) return;
+    out.push_back(static_cast<std::uint8_t>(off));
+    out.push_back(static_cast<std::uint8_t>(off >> 8));
+    if (m >= 15) lz_put_len(out, m - 15);
+}
 
-    // 5) copy each record in one memcpy
-    std::size_t out_off = 0;
-    for (std::size_t i = 0; i < n_idx; ++i) {
-        IndexRec& r = idx[i];
-        std::size_t rec_size = sizeof(r.key) + sizeof(r.len) + r.len;
+static inline void lz_compress(const char* src, std::size_t n, std::vector<std::uint8_t>& out)
+{
+    std::vector<std::uint32_t> table(1u << LZ_HASH_BITS, 0);   // position + 1, 0 = empty
+    auto read32 = [src](std::size_t at) { std::uint32_t v; std::memcpy(&v, src + at, 4); return v; };
+    std::size_t ip = 0, anchor = 0;
+    while (ip + LZ_MIN_MATCH <= n) {
+        const std::uint32_t h    = (read32(ip) * 2654435761u) >> (32 - LZ_HASH_BITS);
+        const std::size_t   cand = table[h];
+        table[h] = static_cast<std::uint32_t>(ip + 1);
+        if (cand && ip - (cand - 1) <= 0xffff && read32(cand - 1) == read32(ip)) {
+            std::size_t mlen = LZ_MIN_MATCH;
+            while (ip + mlen < n && src[cand - 1 + mlen] == src[ip + mlen]) ++mlen;
+            lz_put_seq(out, src + anchor, ip - anchor, ip - (cand - 1), mlen);
+            ip += mlen;
+            anchor = ip;
+        } else {
+            ++ip;
+        }
+    }
+    lz_put_seq(out, src + anchor, n - anchor, 0, 0);
+}
+
+// Returns the number of bytes written to dst
+static inline std::size_t lz_decompress(const std::uint8_t* p, std::size_t n, char* dst)
+{
+    const std::uint8_t* end = p + n;
+    char*               op  = dst;
+    auto get_len = [&p](std::size_t v) {
+        if (v == 15) for (std::uint8_t b = 255; b == 255; v += b) b = *p++;
+        return v;
+    };
+    while (p < end) {
+        const std::uint8_t tok = *p++;
+        const std::size_t  lit = get_len(tok >> 4);
+        std::memcpy(op, p, lit);
+        op += lit; p += lit;
+        if (p >= end) break;
+        const std::size_t off  = p[0] | (static_cast<std::size_t>(p[1]) << 8);
+        p += 2;
+        const std::size_t mlen = get_len(tok & 15) + LZ_MIN_MATCH;
+        for (std::size_t i = 0; i < mlen; ++i, ++op) *op = *(op - off);   // may overlap
+    }
+    return static_cast<std::size_t>(op - dst);
+}
 
-        // direct memcpy from input-mapped region
-        std::memcpy(out_map + out_off,
-                    in_map  + r.offset,
-                    rec_size);
+// Per-block codec counters, printed by the pipeline drivers
+struct RunCodecStats {
+    std::size_t   blocks = 0, decoded = 0;
+    std::uint64_t raw = 0, enc = 0;
+    double        enc_ms = 0, dec_ms = 0;
+    double        enc_min = 1e300, dec_min = 1e300;   // slowest block (MB/s)
 
-        out_off += rec_size;
+    void add_encode(std::uint64_t raw_b, std::uint64_t enc_b, double ms) {
+        ++blocks; raw += raw_b; enc += enc_b; enc_ms += ms;
+        if (ms > 0) enc_min = std::min(enc_min, raw_b / 1e3 / ms);
     }
+    void add_decode(std::uint64_t raw_b, double ms) {
+        ++decoded; dec_ms += ms;
+        if (ms > 0) dec_min = std::min(dec_min, raw_b / 1e3 / ms);
+    }
+    // Compression pays off while the per-block rates stay above the disk bandwidth
+    void print() const {
+        if (!blocks) return;
+        std::printf("[run-codec] %zu blocks, %.1f -> %.1f MiB (ratio %.3f)\n"
+                    "[run-codec] encode %.0f MB/s per block (slowest %.0f), "
+                    "decode %.0f MB/s per block (slowest %.0f)\n",
+                    blocks, raw / 1048576.0, enc / 1048576.0, double(enc) / raw,
+                    raw / 1e3 / std::max(enc_ms, 1e-9), enc_min == 1e300 ? 0.0 : enc_min,
+                    raw / 1e3 / std::max(dec_ms, 1e-9), dec_min == 1e300 ? 0.0 : dec_min);
+    }
+};
 
-    // 6) cleanup
-    munmap(in_map,  in_size);
-    munmap(out_map, out_size);
+// Encode `n` packed records (raw_bytes in total) as one block appended to out
+static inline void encode_run_block(const char* recs, std::size_t n, std::size_t raw_bytes,
+                                    std::vector<std::uint8_t>& out, std::vector<char>& scratch)
+{
+    constexpr std::size_t HDR = REC_HDR;
+    const std::size_t at = out.size();
+    out.resize(at + sizeof(RunBlockHdr));
+
+    scratch.clear();
+    rec_key_t prev = 0;
+    for (std::size_t i = 0, pos = 0; i < n; ++i) {
+        const rec_key_t key = RecSchema::key_at(recs + pos) ^ g_key_spec.mask;   // non-decreasing
+        const uint32_t  len = RecSchema::len_at(recs + pos);
+        put_varint(out, rec_key_t(key - prev));
+        put_varint(out, len);
+        scratch.insert(scratch.end(), recs + pos + HDR, recs + pos + HDR + len);
+        prev = key;
+        pos += HDR + len;
+    }
+    RunBlockHdr h{ static_cast<std::uint32_t>(n), static_cast<std::uint32_t>(raw_bytes),
+                   static_cast<std::uint32_t>(out.size() - at - sizeof(RunBlockHdr)), 0, 1 };
+
+    const std::size_t pay_at = out.size();
+    lz_compress(scratch.data(), scratch.size(), out);
+    if (out.size() - pay_at >= scratch.size()) {   // incompressible: store raw
+        out.resize(pay_at);
+        out.insert(out.end(), scratch.begin(), scratch.end());
+        h.pay_lz = 0;
+    }
+    h.pay_bytes = static_cast<std::uint32_t>(out.size() - pay_at);
+    std::memcpy(out.data() + at, &h, sizeof h);
+}
+
+// Decode the block at p into packed records; returns its encoded size
+static inline std::size_t decode_run_block(const char* p, std::vector<char>& raw, std::vector<char>& scratch)
+{
+    constexpr std::size_t HDR = REC_HDR;
+    RunBlockHdr h;
+    std::memcpy(&h, p, sizeof h);
+    const std::uint8_t* hp  = reinterpret_cast<const std::uint8_t*>(p + sizeof h);
+    const std::uint8_t* pay = hp + h.hdr_bytes;
+
+    const std::size_t pay_sz = h.raw_bytes - h.n * HDR;
+    const char* payloads = reinterpret_cast<const char*>(pay);
+    if (h.pay_lz) {
+        scratch.resize(pay_sz);
+        if (lz_decompress(pay, h.pay_bytes, scratch.data()) != pay_sz) {
+            std::fprintf(stderr, "run block: corrupt payload section\n");
+            std::exit(1);
+        }
+        payloads = scratch.data();
+    }
+
+    raw.resize(h.raw_bytes);
+    rec_key_t key = 0;
+    for (std::size_t i = 0, pos = 0; i < h.n; ++i) {
+        key += get_varint<rec_key_t>(hp);
+        const uint32_t len = static_cast<uint32_t>(get_varint(hp));
+        RecSchema::put_header(raw.data() + pos, key ^ g_key_spec.mask, len);
+        std::memcpy(raw.data() + pos + HDR, payloads, len);
+        payloads += len;
+        pos += HDR + len;
+    }
+    return sizeof h + h.hdr_bytes + h.pay_bytes;
+}
+
+// Append a sorted run (records copied from the input mapping) at byte `at` of fd
+// (with `codec` every block is encoded first and its throughput recorded)
+static inline RunSeg append_run(int fd, std::uint64_t at, const char* in_map,
+                                const IndexRec* run, std::size_t n, std::vector<char>& buf,
+                                RunCodecStats* codec = nullptr)
+{
+    buf.resize(RUN_IO_BLOCK);
+    RunSeg seg{ at, 0 };
+    std::size_t fill = 0, in_block = 0;
+    std::vector<std::uint8_t> enc;
+    std::vector<char>         scratch;
+    auto put_block = [&] {
+        if (!codec) {
+            write_all(fd, buf.data(), fill, at + seg.bytes);
+            seg.bytes += fill;
+        } else if (in_block) {
+            const auto t0 = std::chrono::steady_clock::now();
+            enc.clear();
+            encode_run_block(buf.data(), in_block, fill, enc, scratch);
+            codec->add_encode(fill, enc.size(), std::chrono::duration<double, std::milli>(
+                                                    std::chrono::steady_clock::now() - t0).count());
+            write_all(fd, reinterpret_cast<const char*>(enc.data()), enc.size(), at + seg.bytes);
+            seg.bytes += enc.size();
+        }
+        fill = 0;
+        in_block = 0;
+    };
+    for (std::size_t i = 0; i < n; ++i) {
+        const std::size_t rec_sz = REC_HDR + run[i].len;
+        if (fill + rec_sz > buf.size()) {
+            put_block();
+            if (rec_sz > buf.size()) buf.resize(rec_sz);
+        }
+        fill += put_record(buf.data() + fill, run[i], in_map);
+        ++in_block;
+    }
+    put_block();
+    return seg;
+}
+
+// Read position in one run during the merge: the mapped run itself, or
+// (run codec) the currently decoded block of it
+struct RunCursor {
+    const char*       at   = nullptr;   // current record
+    const char*       lim  = nullptr;   // end of the mapped run / decoded block
+    std::uint64_t     next = 0;         // next encoded block (file offset)
+    std::uint64_t     end  = 0;         // end of the run (file offset)
+    std::vector<char> raw, scratch;
+
+    // false once the run is exhausted
+    bool load(const char* map, RunCodecStats* codec) {
+        if (next >= end) return false;
+        if (!codec) {
+            at = map + next; lim = map + end; next = end;
+            return true;
+        }
+        const auto t0 = std::chrono::steady_clock::now();
+        next += decode_run_block(map + next, raw, scratch);
+        codec->add_decode(raw.size(), std::chrono::duration<double, std::milli>(
+                                          std::chrono::steady_clock::now() - t0).count());
+        at = raw.data(); lim = at + raw.size();
+        return true;
+    }
+};
+
+// K-way merge of the runs of `run_path` straight into `out_path`
+// (run files are always packed v1, encoded if `codec` is given;
+//  the output follows out_lay, v2 without offset table)
+static inline bool merge_run_file(const std::string& run_path, const std::vector<RunSeg>& segs,
+                                  const std::string& out_path, const RecLayout& out_lay = RecLayout{},
+                                  RunCodecStats* codec = nullptr)
+{
+    int fd_in = ::open(run_path.c_str(), O_RDONLY);
+    if (fd_in < 0) { perror("open runs"); return false; }
+    struct stat st{};
+    if (fstat(fd_in, &st) < 0) { perror("fstat runs"); close(fd_in); return false; }
+    const std::size_t in_size = st.st_size;
+    const char* in_map = in_size ? static_cast<const char*>(
+        mmap(nullptr, in_size, PROT_READ, MAP_SHARED, fd_in, 0)) : nullptr;
+    if (in_map == MAP_FAILED) { perror("mmap runs"); close(fd_in); return false; }
+    if (in_size) madvise(const_cast<char*>(in_map), in_size, MADV_SEQUENTIAL);
+
+    int fd_out = ::open(out_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd_out < 0) { perror("open out"); if (in_map) munmap(const_cast<char*>(in_map), in_size); close(fd_in); return false; }
+
+    const int k = static_cast<int>(segs.size());
+    std::vector<RunCursor> cur_run(k);
+    LoserTree lt;
+    lt.k = k;
+    lt.head.resize(k);
+    lt.done.resize(k);
+    for (int r = 0; r < k; ++r) {
+        cur_run[r].next = segs[r].off;
+        cur_run[r].end  = segs[r].off + segs[r].bytes;
+        lt.done[r] = !cur_run[r].load(in_map, codec);
+        if (!lt.done[r]) lt.head[r] = sort_key_at(cur_run[r].at);
+    }
+    if (k > 0) lt.build();
+
+    std::vector<char> buf[2] = { std::vector<char>(RUN_IO_BLOCK), std::vector<char>(RUN_IO_BLOCK) };
+    std::future<void> pending;
+    std::uint64_t     out_off = out_lay.data_off;
+    std::uint64_t     n_out   = 0;
+    std::size_t       fill    = 0;
+    int               cur     = 0;
+    auto flush = [&] {
+        if (pending.valid()) pending.get();
+        pending = std::async(std::launch::async,
+                             [fd_out, data = buf[cur].data(), fill, at = out_off] { write_all(fd_out, data, fill, at); });
+        out_off += fill;
+        fill = 0;
+        cur ^= 1;
+    };
+
+    for (int w = k ? lt.winner() : 0; k > 0 && !lt.done[w]; w = lt.winner()) {
+        RunCursor& c = cur_run[w];
+        const uint32_t    len    = RecSchema::len_at(c.at);
+        const std::size_t rec_sz = REC_HDR + len;
+        const std::size_t span   = rec_span(len, out_lay);
+        if (fill + span > buf[cur].size()) {
+            flush();
+            if (span > buf[cur].size()) buf[cur].resize(span);
+        }
+        std::memcpy(buf[cur].data() + fill, c.at, rec_sz);
+        std::memset(buf[cur].data() + fill + rec_sz, 0, span - rec_sz);
+        fill += span;
+        ++n_out;
+
+        c.at += rec_sz;
+        if (c.at == c.lim && !c.load(in_map, codec)) lt.done[w] = 1;
+        else lt.head[w] = sort_key_at(c.at);
+        lt.replay(w);
+    }
+    if (fill > 0) flush();
+    if (pending.valid()) pending.get();
+    if (out_lay.v2) {
+        const FileHeaderV2 h = make_header_v2(n_out, out_off, /*offsets_at=*/0, /*sorted=*/true);
+        write_all(fd_out, reinterpret_cast<const char*>(&h), sizeof h, 0);
+    }
+
+    if (in_map) munmap(const_cast<char*>(in_map), in_size);
     close(fd_in);
     close(fd_out);
-    free(idx);
     return true;
 }
 
 
+// Autotuning (--autotune)
+// Short probes on the head of the input measure the leaf sort (ns per record
+// per log2 of the run), the binary merge (ns per record) and the cost of
+// starting a thread. A simple model of the task mergesort
+//   leaves   : N log2(c) * sort / min(t, L)            L = N / c leaves
+//   merges   : sum over levels of N * merge / min(t, merges on that level)
+//   overhead : 2L tasks * TUNE_TASK_US / t + t * spawn
+// is minimised over cutoff c and threads t, so small inputs end up with few
+// threads. For the pipeline drivers the run length fixes the fan-in k of the
+// final serial merge: k is chosen to balance N log2(N/k) sort over min(t, k)
+// sorters against the N log2(k) merge. The result is written to
+// files/tune_<N>_<P>_t<T><schema>.cfg and reused by later runs with the same
+// shape and record schema.
+struct TuneConfig {
+    std::size_t cutoff  = 0;
+    std::size_t threads = 0;
+    std::size_t run_len = 0;
+};
+
+constexpr double      TUNE_TASK_US  = 2.0;        // bookkeeping per task (spawn + schedule)
+constexpr std::size_t TUNE_SAMPLE   = 1 << 16;    // records probed
+
+static inline double tune_time_ms(const std::function<void()>& fn, int reps = 3)
+{
+    double best = 1e300;
+    for (int r = 0; r < reps; ++r) {
+        const auto t0 = std::chrono::steady_clock::now();
+        fn();
+        best = std::min(best, std::chrono::duration<double, std::milli>(
+                                  std::chrono::steady_clock::now() - t0).count());
+    }
+    return best;
+}
+
+static inline double tune_model_ms(double n, double c, double t,
+                                   double sort_ns, double merge_ns, double spawn_us)
+{
+    const double leaves = std::max(1.0, std::ceil(n / c));
+    double ms = n * std::log2(std::max(2.0, std::min(c, n))) * sort_ns * 1e-6 / std::min(t, leaves);
+    for (double merges = std::floor(leaves / 2); merges >= 1; merges = std::floor(merges / 2))
+        ms += n * merge_ns * 1e-6 / std::min(t, merges);
+    ms += 2 * leaves * TUNE_TASK_US * 1e-3 / t + t * spawn_us * 1e-3;
+    return ms;
+}
+
+// `n_sort` records per sorter (N, or N/P per MPI rank), at most `max_threads` threads
+static inline TuneConfig autotune_params(const std::string& unsorted_file, std::size_t n_sort,
+                                         std::uint32_t payload_max, std::size_t max_threads)
+{
+    BENCH_START(autotune);
+    max_threads = std::max<std::size_t>(1, max_threads);
+    const std::string cfg_path = "files/tune_" + std::to_string(n_sort) + "_"
+                               + std::to_string(payload_max) + "_t" + std::to_string(max_threads)
+                               + schema_tag() + (SPARE_KEY_BITS ? "s" + std::to_string(SORT_KEY_BITS) : "") + ".cfg";
+    TuneConfig cfg;
+
+    if (FILE* f = std::fopen(cfg_path.c_str(), "r")) {
+        char line[128];
+        while (std::fgets(line, sizeof line, f)) {
+            std::sscanf(line, "cutoff=%zu",  &cfg.cutoff);
+            std::sscanf(line, "threads=%zu", &cfg.threads);
+            std::sscanf(line, "run=%zu",     &cfg.run_len);
+        }
+        std::fclose(f);
+        if (cfg.cutoff && cfg.threads && cfg.run_len) {
+            std::printf("[autotune] reusing %s: cutoff=%zu threads=%zu run=%zu\n",
+                        cfg_path.c_str(), cfg.cutoff, cfg.threads, cfg.run_len);
+            BENCH_STOP(autotune);
+            return cfg;
+        }
+    }
+
+    // Probe sample: the first records of the input
+    int fd = ::open(unsorted_file.c_str(), O_RDONLY);
+    if (fd < 0) { std::perror("open"); std::exit(1); }
+    struct stat st{};
+    if (fstat(fd, &st) < 0) { std::perror("fstat"); std::exit(1); }
+    const std::size_t file_sz = static_cast<std::size_t>(st.st_size);
+    void* map = ::mmap(nullptr, file_sz, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) { std::perror("mmap"); std::exit(1); }
+    std::vector<IndexRec> sample(std::max<std::size_t>(2, std::min(n_sort, TUNE_SAMPLE)));
+    const RecLayout lay = record_layout(map, file_sz);
+    std::uint64_t pos = lay.data_off;
+    const std::size_t have = std::min(sample.size(), n_sort);
+    read_index_chunk(static_cast<const char*>(map), pos, sample.data(), have, lay);
+    for (std::size_t i = have; i < sample.size(); ++i) sample[i] = sample[i - have];
+    munmap(map, file_sz);
+    close(fd);
+
+    const double n_s = static_cast<double>(sample.size());
+    std::vector<IndexRec> work;
+
+    // Leaf sort: ns per record per log2(n)
+    const double sort_ms = tune_time_ms([&] { work = sample; sort_records(work.data(), work.size()); });
+    const double copy_ms = tune_time_ms([&] { work = sample; });
+    const double sort_ns = std::max(1e-3, (sort_ms - copy_ms) * 1e6 / (n_s * std::log2(n_s)));
+
+    // Binary merge of two sorted halves: ns per record
+    std::vector<IndexRec> halves = sample;
+    const std::size_t mid = halves.size() / 2;
+    sort_records(halves.data(), mid);
+    sort_records(halves.data() + mid, halves.size() - mid);
+    const double merge_ms = tune_time_ms([&] { work = halves; merge_records(work.data(), 0, mid - 1, work.size() - 1); });
+    const double merge_ns = std::max(1e-3, (merge_ms - copy_ms) * 1e6 / n_s);
+
+    // Thread start + join: µs per thread
+    const double spawn_ms = tune_time_ms([&] {
+        std::vector<std::thread> ts;
+        for (std::size_t i = 0; i < max_threads; ++i) ts.emplace_back([] {});
+        for (auto& th : ts) th.join();
+    });
+    const double spawn_us = spawn_ms * 1e3 / max_threads;
+
+    // Cutoff and threads
+    const double n  = static_cast<double>(n_sort);
+    double       best = 1e300;
+    for (std::size_t c = 256; ; c *= 2) {
+        const std::size_t cc = std::min(c, n_sort);
+        for (std::size_t t = 1; t <= max_threads; ++t) {
+            const double ms = tune_model_ms(n, static_cast<double>(cc), static_cast<double>(t),
+                                            sort_ns, merge_ns, spawn_us);
+            if (ms < best * 0.98) { best = ms; cfg.cutoff = cc; cfg.threads = t; }   // ties: fewer threads, smaller cutoff
+        }
+        if (c >= n_sort) break;
+    }
+
+    // Run length of the pipeline drivers (fan-in of the final merge)
+    double best_run = 1e300;
+    for (std::size_t k = 1; k <= 256 && k <= n_sort; k *= 2) {
+        const double t  = static_cast<double>(std::min<std::size_t>(cfg.threads, k));
+        const double ms = n * std::log2(std::max(2.0, n / k)) * sort_ns * 1e-6 / t
+                        + n * std::log2(static_cast<double>(std::max<std::size_t>(2, k))) * merge_ns * 1e-6;
+        if (ms < best_run * 0.98) { best_run = ms; cfg.run_len = (n_sort + k - 1) / k; }
+    }
+
+    std::printf("[autotune] sort %.2f ns/rec/lg  merge %.2f ns/rec  spawn %.1f us/thread\n",
+                sort_ns, merge_ns, spawn_us);
+    std::printf("[autotune] cutoff=%zu threads=%zu run=%zu (model %.3f ms) -> %s\n",
+                cfg.cutoff, cfg.threads, cfg.run_len, best, cfg_path.c_str());
+
+    if (FILE* f = std::fopen(cfg_path.c_str(), "w")) {
+        std::fprintf(f, "# autotune N=%zu P=%u max_threads=%zu\n", n_sort, payload_max, max_threads);
+        std::fprintf(f, "cutoff=%zu\nthreads=%zu\nrun=%zu\n", cfg.cutoff, cfg.threads, cfg.run_len);
+        std::fclose(f);
+    }
+    BENCH_STOP(autotune);
+    return cfg;
+}
+
+static inline void apply_tune(Params& opt, const TuneConfig& cfg)
+{
+    opt.cutoff    = cfg.cutoff;
+    opt.n_threads = cfg.threads;
+    opt.run_len   = cfg.run_len;
+}
+
+
 // Verification                                                                
+// The output is split into one chunk per thread. v2 outputs with an offset
+// table are split by record index; otherwise each thread resynchronises on a
+// record boundary near its share of the bytes (VERIFY_SYNC plausible records
+// in key order) and the thread before it must end exactly there, so a wrong
+// guess is caught and the check falls back to a single serial walk.
+// Drivers pass their own thread count so the check_if_sorted timing uses the
+// same cores as the rest of the row; the default is the serial walk.
+constexpr std::size_t VERIFY_SYNC      = 32;
+constexpr std::size_t VERIFY_MIN_BYTES = 8u << 20;   // smaller outputs: one thread
+
+enum VerifyFail { VERIFY_OK, VERIFY_EOF, VERIFY_ORDER, VERIFY_OFFSET };
+
+struct VerifyChunk {
+    std::uint64_t from = 0, to = 0;     // records starting in [from, to)
+    std::size_t   first = 0;            // index of the first record (offset table split)
+    std::size_t   n = 0;                // records walked
+    std::uint64_t end = 0;              // where the walk stopped
+    sort_key_t    first_key = 0, last_key = 0;
+    VerifyFail    fail = VERIFY_OK;
+};
+
+static inline void verify_chunk(const char* map, const RecLayout& lay, std::uint64_t data_end,
+                                const std::uint64_t* offsets, VerifyChunk& c)
+{
+    constexpr std::size_t HDR = REC_HDR;
+    std::uint64_t pos = c.from;
+    while (pos < c.to) {
+        if (offsets && offsets[c.first + c.n] != pos) { c.fail = VERIFY_OFFSET; break; }
+        if (pos + HDR > data_end)                     { c.fail = VERIFY_EOF;    break; }
+        const uint32_t  len = RecSchema::len_at(map + pos);
+        if (pos + HDR + len > data_end)               { c.fail = VERIFY_EOF;    break; }
+        const sort_key_t key = sort_key_at(map + pos);   // may read payload (--key fields)
+        if (c.n == 0) c.first_key = key;
+        else if (key_less(key, c.last_key))           { c.fail = VERIFY_ORDER;  break; }
+        c.last_key = key;
+        ++c.n;
+        pos += rec_span(len, lay);
+    }
+    c.end = pos;
+}
+
+// First position >= at from which VERIFY_SYNC records parse in key order
+// (unsorted inputs: ordered = false, and lengths must not exceed max_len)
+static inline std::uint64_t verify_sync(const char* map, const RecLayout& lay,
+                                        std::uint64_t at, std::uint64_t data_end,
+                                        bool ordered = true, std::uint32_t max_len = RecSchema::MAX_LEN)
+{
+    constexpr std::size_t HDR = REC_HDR;
+    for (std::uint64_t q = (at + lay.align - 1) / lay.align * lay.align; q + HDR <= data_end; q += lay.align) {
+        std::uint64_t pos  = q;
+        sort_key_t    prev = 0;
+        std::size_t   k    = 0;
+        for (; k < VERIFY_SYNC && pos + HDR <= data_end; ++k) {
+            const uint32_t  len = RecSchema::len_at(map + pos);
+            if (len > max_len || pos + HDR + len > data_end) break;
+            const sort_key_t key = sort_key_at(map + pos);
+            if (ordered && k > 0 && key_less(key, prev)) break;
+            prev = key;
+            pos += rec_span(len, lay);
+        }
+        if (k == VERIFY_SYNC || pos == data_end) return q;
+    }
+    return data_end;
+}
+
 static bool check_if_sorted_mmap(const std::string& path,
-                                 std::size_t        total_n)
+                                 std::size_t        total_n,
+                                 int                threads = 1)
 {
     int fd = ::open(path.c_str(), O_RDONLY);
     if (fd < 0) { perror("open"); return false; }
@@ -446,30 +2252,82 @@ static bool check_if_sorted_mmap(const std::string& path,
     char* map = (char*)mmap(nullptr, sz,
                             PROT_READ, MAP_SHARED, fd, 0);
     if (map == MAP_FAILED) { perror("mmap"); close(fd); return false; }
+    auto fail = [&](const std::string& msg) {
+        std::cerr << msg << "\n";
+        munmap(map, sz);
+        close(fd);
+        return false;
+    };
 
-    std::size_t pos = 0;
-    unsigned long prev_key = 0;
-    for (std::size_t i = 0; i < total_n; ++i) {
-        if (pos + sizeof(unsigned long)+sizeof(uint32_t) > sz) {
-            std::cerr << "Unexpected EOF at record " << i << "\n";
-            munmap(map, sz);
-            close(fd);
-            return false;
+    // v2: the header must agree with the caller, the file and carry the sorted flag
+    const RecLayout lay = record_layout(map, sz);
+    if (lay.v2 && (lay.n != total_n || !(lay.flags & V2_SORTED)))
+        return fail("Bad v2 header: " + std::to_string(lay.n) + " records (" + std::to_string(total_n)
+                    + " expected), " + ((lay.flags & V2_SORTED) ? "sorted" : "not marked sorted"));
+    if (lay.v2 && lay.total != sz)
+        return fail("Bad v2 header: " + std::to_string(lay.total) + " bytes, file has " + std::to_string(sz));
+    const std::uint64_t* offsets = (lay.v2 && lay.offsets_at)
+        ? reinterpret_cast<const std::uint64_t*>(map + lay.offsets_at) : nullptr;
+    const std::uint64_t data_end = offsets ? lay.offsets_at : sz;
+    if (offsets && lay.offsets_at + total_n * sizeof(std::uint64_t) != sz)
+        return fail("Offset table does not match the record count");
+
+    std::size_t T = static_cast<std::size_t>(std::max(1, threads));
+    if (data_end - lay.data_off < VERIFY_MIN_BYTES) T = 1;
+    if (offsets) T = std::max<std::size_t>(1, std::min(T, total_n));
+
+    // Split: by record index (offset table) or at resynchronised byte positions
+    std::vector<VerifyChunk> chunk(T);
+    for (std::size_t t = 0; t < T; ++t) {
+        if (offsets) {
+            chunk[t].first = total_n * t / T;
+            chunk[t].from  = chunk[t].first < total_n ? offsets[chunk[t].first] : data_end;
+        } else {
+            chunk[t].from = t ? verify_sync(map, lay, lay.data_off + (data_end - lay.data_off) * t / T, data_end)
+                              : lay.data_off;
+            if (t) chunk[t].from = std::max(chunk[t].from, chunk[t - 1].from);
         }
+    }
+    for (std::size_t t = 0; t < T; ++t) chunk[t].to = t + 1 < T ? chunk[t + 1].from : data_end;
+
+    auto walk = [&] {
+        std::vector<std::thread> ts;
+        for (std::size_t t = 1; t < T; ++t)
+            ts.emplace_back([&, t] { verify_chunk(map, lay, data_end, offsets, chunk[t]); });
+        verify_chunk(map, lay, data_end, offsets, chunk[0]);
+        for (auto& th : ts) th.join();
+    };
+    walk();
+
+    // A chunk that did not end on the next one's start means a wrong resync guess
+    // (or a broken record chain): redo it as one serial walk for an exact report
+    bool joined = true;
+    for (std::size_t t = 0; t < T; ++t)
+        if (chunk[t].fail == VERIFY_OK && chunk[t].end != chunk[t].to) joined = false;
+    if (!joined && !offsets) {
+        T = 1;
+        chunk.assign(1, VerifyChunk{ lay.data_off, data_end });
+        walk();
+    }
 
-        unsigned long key = *reinterpret_cast<unsigned long*>(map + pos);
-        uint32_t      len = *reinterpret_cast<uint32_t*>     (map + pos + sizeof(unsigned long));
-
-        if (i > 0 && key < prev_key) {
-            std::cerr << "Out of order at record " << i
-                      << ": " << key << " < " << prev_key << "\n";
-            munmap(map, sz);
-            close(fd);
-            return false;
-        }
-        prev_key = key;
-        pos += sizeof(unsigned long) + sizeof(uint32_t) + len;
+    std::size_t n = 0;
+    bool have_prev = false;
+    sort_key_t prev_key = 0;
+    for (std::size_t t = 0; t < T; ++t) {
+        const VerifyChunk& c = chunk[t];
+        const std::string at = std::to_string(n + c.n);
+        if (c.fail == VERIFY_OFFSET) return fail("Offset table mismatch at record " + at);
+        if (c.fail == VERIFY_EOF)    return fail("Unexpected EOF at record " + at);
+        if (c.fail == VERIFY_ORDER)  return fail("Out of order at record " + at);
+        if (c.end != c.to)           return fail("Record chain broken at record " + at);
+        if (c.n && have_prev && key_less(c.first_key, prev_key))
+            return fail("Out of order at record " + std::to_string(n) + ": "
+                        + key_str(c.first_key) + " < " + key_str(prev_key));
+        if (c.n) { prev_key = c.last_key; have_prev = true; }
+        n += c.n;
     }
+    if (n != total_n)
+        return fail("Record count mismatch: " + std::to_string(n) + " (" + std::to_string(total_n) + " expected)");
 
     munmap(map, sz);
     close(fd);
@@ -484,4 +2342,54 @@ static bool check_if_sorted_mmap(const std::string& path,
 }
 
 
+// Small-input fast path
+// Below a few hundred thousand records the parallel drivers spend most of their
+// time in runtime setup (thread pools, task creation, gate handshakes, farm
+// start-up) rather than sorting. Under the threshold they run this instead: the
+// index built and sorted on the calling thread, then the usual rewrite. The
+// threshold is a fixed 1<<17 records (not measured per machine), raised to two
+// leaves' worth of records so it scales with the cutoff (and with --autotune).
+// --direct, --rewrite and --window still apply. Flags that select a different
+// algorithm (--dag, -s, -m, --chunk, --checkpoint, -z) turn the fast path off,
+// so a run asking for them measures them at any N.
+constexpr std::size_t SMALL_INPUT_RECORDS = 1 << 17;
+
+static inline std::size_t small_input_records(const Params& opt)
+{
+    if (opt.dag || opt.sample || opt.compress || opt.dist_chunk || !opt.checkpoint_dir.empty()
+        || opt.merge != "pairwise")
+        return 0;
+    return std::max<std::size_t>(2 * opt.cutoff, SMALL_INPUT_RECORDS);
+}
+
+static inline bool small_input(const Params& opt)
+{
+    return opt.n_records <= small_input_records(opt);
+}
+
+static inline void run_small_input(const std::string& unsorted_file, const Params& opt)
+{
+    std::printf("[small-input] %zu records: single-threaded path\n", opt.n_records);
+    const std::string sorted_file = "files/sorted_" + std::to_string(opt.n_records) + "_"
+                                  + std::to_string(opt.payload_max) + ".bin";
+
+    BENCH_START(reading_and_sorting);
+    IndexRec* idx = build_index_mmap(unsorted_file, opt.n_records, opt.direct);
+    sort_records(idx, opt.n_records);
+    BENCH_STOP(reading_and_sorting);
+
+    // rewrite_sorted_mmap frees idx
+    BENCH_START(writing);
+    if (!rewrite_sorted_mmap(unsorted_file, sorted_file, idx, opt.n_records, opt.rewrite, opt.window_mb))
+        std::exit(1);
+    BENCH_STOP(writing);
+
+    BENCH_START(check_if_sorted);
+    check_if_sorted_mmap(sorted_file, opt.n_records,
+                         opt.n_threads > 0 ? static_cast<int>(opt.n_threads)
+                                           : static_cast<int>(std::thread::hardware_concurrency()));
+    BENCH_STOP(check_if_sorted);
+}
+
+
 #endif /* UTILS_HPP */